@@ -12,19 +12,19 @@
 #include "object.h"
 #include "debug.h"
 #include "semantics.h"
+#include "cfg.h"
+#include "regalloc.h"
+#include "mips.h"
+#include "peephole.h"
+#include "ir.h"
+#include "writer.h"
 
 void asm_log(int lineno, char *format, ...);
 
 const char *store_tvars = "bee845c68e1c_store_tvars";
 const char *load_tvars = "bee845c68e1c_load_tvars";
-static void **vars = NULL;
 static ast *ast_tree = NULL;
 
-const char *reg_names[32] = {
-    "$zero", "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3", "$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7",
-    "$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7", "$t8", "$t9", "$k0", "$k1",
-    "$gp", "$sp", "$fp", "$ra"};
-
 typedef struct
 {
     int id;
@@ -32,7 +32,33 @@ typedef struct
 
 static reg *regs[32];
 
-static FILE *asm_output = NULL;
+// $t0-$t7 and $s0-$s7 hold vars, $t8 and $t9 are left as scratch
+static const int caller_saved[] = {8, 9, 10, 11, 12, 13, 14, 15};
+static const int callee_saved[] = {16, 17, 18, 19, 20, 21, 22, 23};
+static regalloc *allocation = NULL;
+
+// The first args go in $a0-$a3, the rest on the stack
+#define ARG_REGS 4
+
+// The frame of a function, $fp points at its bottom:
+//   0($fp)               caller's $fp
+//   4($fp)               $ra
+//   8($fp)...            callee-saved registers, vars in memory, save
+//                        area and DEC arrays
+//   frame_size($fp)...   stack args pushed by the caller, lowest first
+#define FRAME_RESERVED 8
+static int param_count = 0;
+
+static writer *asm_writer = NULL;
+static mips_list *asm_code = NULL;
+static bool asm_comments = true;
+static int asm_line = 0; // lines written so far
+
+// Source map, the range being built covers asm lines map_first..asm_line
+static writer *map_writer = NULL;
+static int map_first = 0;
+static int map_ir_line = 0;
+static int map_src_line = 0;
 static bool asm_is_passed = false;
 static char asm_buffer[1024];
 
@@ -45,11 +71,22 @@ static reg *new_reg(int id)
     return r;
 }
 
-static reg *get_reg_rs() // ra for var store
+// scratch registers for operands living in memory, never allocated
+static reg *get_reg_t8()
 {
     return regs[24];
 }
 
+static reg *get_reg_t9()
+{
+    return regs[25];
+}
+
+static reg *get_reg_zero()
+{
+    return regs[0];
+}
+
 static reg *get_reg_fp()
 {
     return regs[30];
@@ -75,128 +112,241 @@ static reg *get_reg_a0()
     return regs[4];
 }
 
-static void asm_out(char *format, ...)
+static reg *get_reg_arg(int index)
 {
-    va_list aptr;
-    int ret;
-
-    va_start(aptr, format);
-    vsprintf(asm_buffer, format, aptr);
-    va_end(aptr);
-
-    fprintf(asm_output, "%s\n", asm_buffer);
+    return regs[4 + index];
 }
 
-static void asm_out_instr(char *format, ...)
+// Instructions of the current function, printed after the peephole pass
+static mips_instr *asm_emit(mips_op op)
 {
-    va_list aptr;
-    int ret;
-
-    va_start(aptr, format);
-    vsprintf(asm_buffer, format, aptr);
-    va_end(aptr);
-
-    fprintf(asm_output, "  %s\n", asm_buffer);
+    return mips_push(asm_code, op);
 }
 
-static void gen_label(const char *name)
+static void asm_comment(const char *text)
 {
-    asm_out("%s:", name);
+    asm_emit(MI_Comment)->text = text;
 }
 
-static void gen_lw(reg *rt, reg *rs, short imm)
+static void gen_label(const char *name)
 {
-    asm_out_instr("lw %s, %d(%s)", reg_names[rt->id], (int)imm, reg_names[rs->id]);
+    asm_emit(MI_Label)->label = name;
 }
 
-static void gen_sw(reg *rt, reg *rs, short imm)
+static void gen_lw(reg *rt, reg *rs, int imm)
 {
-    asm_out_instr("sw %s, %d(%s)", reg_names[rt->id], (int)imm, reg_names[rs->id]);
+    mips_instr *in = asm_emit(MI_Lw);
+    in->rt = rt->id;
+    in->rs = rs->id;
+    in->imm = imm;
 }
 
-static void gen_la(reg *dest, const char *addr)
+static void gen_sw(reg *rt, reg *rs, int imm)
 {
-    asm_out_instr("la %s, %s", reg_names[dest->id], addr);
+    mips_instr *in = asm_emit(MI_Sw);
+    in->rt = rt->id;
+    in->rs = rs->id;
+    in->imm = imm;
 }
 
 static void gen_li(reg *dest, int imm)
 {
-    asm_out_instr("li %s, %d", reg_names[dest->id], imm);
+    mips_instr *in = asm_emit(MI_Li);
+    in->rd = dest->id;
+    in->imm = imm;
 }
 
 static void gen_move(reg *dest, reg *src)
 {
-    asm_out_instr("move %s, %s", reg_names[dest->id], reg_names[src->id]);
+    mips_instr *in = asm_emit(MI_Move);
+    in->rd = dest->id;
+    in->rs = src->id;
 }
 
 static void gen_bgt(reg *src1, reg *src2, const char *label)
 {
-    asm_out_instr("bgt %s, %s, %s", reg_names[src1->id], reg_names[src2->id], label);
+    mips_instr *in = asm_emit(MI_Bgt);
+    in->rs = src1->id;
+    in->rt = src2->id;
+    in->label = label;
 }
 
 static void gen_bge(reg *src1, reg *src2, const char *label)
 {
-    asm_out_instr("bge %s, %s, %s", reg_names[src1->id], reg_names[src2->id], label);
+    mips_instr *in = asm_emit(MI_Bge);
+    in->rs = src1->id;
+    in->rt = src2->id;
+    in->label = label;
 }
 
 static void gen_blt(reg *src1, reg *src2, const char *label)
 {
-    asm_out_instr("blt %s, %s, %s", reg_names[src1->id], reg_names[src2->id], label);
+    mips_instr *in = asm_emit(MI_Blt);
+    in->rs = src1->id;
+    in->rt = src2->id;
+    in->label = label;
 }
 
 static void gen_ble(reg *src1, reg *src2, const char *label)
 {
-    asm_out_instr("ble %s, %s, %s", reg_names[src1->id], reg_names[src2->id], label);
+    mips_instr *in = asm_emit(MI_Ble);
+    in->rs = src1->id;
+    in->rt = src2->id;
+    in->label = label;
 }
 
 static void gen_beq(reg *src1, reg *src2, const char *label)
 {
-    asm_out_instr("beq %s, %s, %s", reg_names[src1->id], reg_names[src2->id], label);
+    mips_instr *in = asm_emit(MI_Beq);
+    in->rs = src1->id;
+    in->rt = src2->id;
+    in->label = label;
 }
 
 static void gen_bne(reg *src1, reg *src2, const char *label)
 {
-    asm_out_instr("bne %s, %s, %s", reg_names[src1->id], reg_names[src2->id], label);
+    mips_instr *in = asm_emit(MI_Bne);
+    in->rs = src1->id;
+    in->rt = src2->id;
+    in->label = label;
 }
 
 static void gen_add(reg *rd, reg *rs, reg *rt)
 {
-    asm_out_instr("add %s, %s, %s", reg_names[rd->id], reg_names[rs->id], reg_names[rt->id]);
+    mips_instr *in = asm_emit(MI_Add);
+    in->rd = rd->id;
+    in->rs = rs->id;
+    in->rt = rt->id;
 }
 
-static void gen_addi(reg *rt, reg *rs, short imm)
+static void gen_addi(reg *rd, reg *rs, int imm)
 {
-    asm_out_instr("addi %s, %s, %d", reg_names[rt->id], reg_names[rs->id], (int)imm);
+    mips_instr *in = asm_emit(MI_Addi);
+    in->rd = rd->id;
+    in->rs = rs->id;
+    in->imm = imm;
 }
 
 static void gen_sub(reg *rd, reg *rs, reg *rt)
 {
-    asm_out_instr("sub %s, %s, %s", reg_names[rd->id], reg_names[rs->id], reg_names[rt->id]);
+    mips_instr *in = asm_emit(MI_Sub);
+    in->rd = rd->id;
+    in->rs = rs->id;
+    in->rt = rt->id;
+}
+
+// -rs without the overflow trap of sub, so -INT_MIN wraps like C-- does
+static void gen_neg(reg *rd, reg *rs)
+{
+    mips_instr *in = asm_emit(MI_Subu);
+    in->rd = rd->id;
+    in->rs = get_reg_zero()->id;
+    in->rt = rs->id;
 }
 
 static void gen_mul(reg *rd, reg *rs, reg *rt)
 {
-    asm_out_instr("mul %s, %s, %s", reg_names[rd->id], reg_names[rs->id], reg_names[rt->id]);
+    mips_instr *in = asm_emit(MI_Mul);
+    in->rd = rd->id;
+    in->rs = rs->id;
+    in->rt = rt->id;
 }
 
 static void gen_div(reg *rd, reg *rs, reg *rt)
 {
-    asm_out_instr("div %s, %s, %s", reg_names[rd->id], reg_names[rs->id], reg_names[rt->id]);
+    mips_instr *in = asm_emit(MI_Div);
+    in->rd = rd->id;
+    in->rs = rs->id;
+    in->rt = rt->id;
+}
+
+static void gen_beqz(reg *src, const char *label)
+{
+    mips_instr *in = asm_emit(MI_Beqz);
+    in->rs = src->id;
+    in->label = label;
+}
+
+static void gen_bnez(reg *src, const char *label)
+{
+    mips_instr *in = asm_emit(MI_Bnez);
+    in->rs = src->id;
+    in->label = label;
+}
+
+static void gen_bgtz(reg *src, const char *label)
+{
+    mips_instr *in = asm_emit(MI_Bgtz);
+    in->rs = src->id;
+    in->label = label;
+}
+
+static void gen_bgez(reg *src, const char *label)
+{
+    mips_instr *in = asm_emit(MI_Bgez);
+    in->rs = src->id;
+    in->label = label;
+}
+
+static void gen_bltz(reg *src, const char *label)
+{
+    mips_instr *in = asm_emit(MI_Bltz);
+    in->rs = src->id;
+    in->label = label;
+}
+
+static void gen_blez(reg *src, const char *label)
+{
+    mips_instr *in = asm_emit(MI_Blez);
+    in->rs = src->id;
+    in->label = label;
+}
+
+static void gen_slti(reg *rd, reg *rs, int imm)
+{
+    mips_instr *in = asm_emit(MI_Slti);
+    in->rd = rd->id;
+    in->rs = rs->id;
+    in->imm = imm;
+}
+
+static void gen_sll(reg *rd, reg *rs, int shamt)
+{
+    mips_instr *in = asm_emit(MI_Sll);
+    in->rd = rd->id;
+    in->rs = rs->id;
+    in->imm = shamt;
+}
+
+static void gen_sra(reg *rd, reg *rs, int shamt)
+{
+    mips_instr *in = asm_emit(MI_Sra);
+    in->rd = rd->id;
+    in->rs = rs->id;
+    in->imm = shamt;
+}
+
+static void gen_srl(reg *rd, reg *rs, int shamt)
+{
+    mips_instr *in = asm_emit(MI_Srl);
+    in->rd = rd->id;
+    in->rs = rs->id;
+    in->imm = shamt;
 }
 
 static void gen_j(const char *label)
 {
-    asm_out_instr("j %s", label);
+    asm_emit(MI_J)->label = label;
 }
 
 static void gen_jal(const char *label)
 {
-    asm_out_instr("jal %s", label);
+    asm_emit(MI_Jal)->label = label;
 }
 
 static void gen_jr(reg *r)
 {
-    asm_out_instr("jr %s", reg_names[r->id]);
+    asm_emit(MI_Jr)->rs = r->id;
 }
 
 static void gen_push(reg *r)
@@ -206,64 +356,78 @@ static void gen_push(reg *r)
     gen_sw(r, sp, 0);
 }
 
-static void gen_pop(reg *r)
+static reg *var_reg(irvar *var)
 {
-    reg *sp = get_reg_sp();
-    gen_lw(r, sp, 0);
-    gen_addi(sp, sp, 4);
+    int id = allocation->reg_of[var->id];
+    return id < 0 ? NULL : regs[id];
 }
 
-static reg *get_reg()
+static void gen_lw_var(reg *rt, irvar *var)
 {
-    static int current = 8;
+    gen_lw(rt, get_reg_fp(), allocation->slot_of[var->id]);
+}
 
-    reg *r = regs[current];
-    current++;
-    if (current > 23)
-        current = 8;
-    return r;
+static void gen_sw_var(reg *rt, irvar *var)
+{
+    gen_sw(rt, get_reg_fp(), allocation->slot_of[var->id]);
 }
 
-static void prepare_var(irvar *var, reg *r)
+// Register holding the value of var, loading it into scratch if the var
+// lives in memory.
+static reg *prepare_var(irvar *var, reg *scratch)
 {
-    reg *temp = get_reg();
-    gen_la(temp, var->name);
-    gen_lw(r, temp, 0);
+    reg *r = var_reg(var);
+    if (r != NULL)
+        return r;
+    gen_lw_var(scratch, var);
+    return scratch;
 }
 
-static void prepare_oprand(irop *op, reg *r)
+static reg *prepare_oprand(irop *op, reg *scratch)
 {
-    reg *temp = get_reg();
     switch (op->kind)
     {
     case IRO_Variable:
-        prepare_var(op->var, r);
-        break;
+    case IRO_Ref: // DEC set var's data with addr
+        return prepare_var(op->var, scratch);
     case IRO_Constant:
-        gen_li(r, op->value);
-        break;
+        gen_li(scratch, op->value);
+        return scratch;
     case IRO_Deref:
-        gen_la(temp, op->var->name);
-        gen_lw(temp, temp, 0);
-        gen_lw(r, temp, 0);
-        break;
-    case IRO_Ref: // DEC set var's data with addr
-        gen_la(temp, op->var->name);
-        gen_lw(r, temp, 0);
-        break;
+    {
+        reg *addr = prepare_var(op->var, scratch);
+        gen_lw(scratch, addr, 0);
+        return scratch;
+    }
     }
+    return NULL;
+}
+
+static void prepare_oprand_to(irop *op, reg *dest)
+{
+    reg *r = prepare_oprand(op, dest);
+    if (r != dest)
+        gen_move(dest, r);
+}
+
+// Register to compute a var into before apply_var.
+static reg *target_var(irvar *var, reg *scratch)
+{
+    reg *r = var_reg(var);
+    return r != NULL ? r : scratch;
 }
 
 static void apply_var(irvar *var, reg *r)
 {
-    reg *temp = get_reg();
-    gen_la(temp, var->name);
-    gen_sw(r, temp, 0);
+    reg *home = var_reg(var);
+    if (home == NULL)
+        gen_sw_var(r, var);
+    else if (home != r)
+        gen_move(home, r);
 }
 
-static void apply_oprand(irop *op, reg *r)
+static void apply_oprand(irop *op, reg *r, reg *scratch)
 {
-    reg *temp = get_reg();
     switch (op->kind)
     {
     case IRO_Variable:
@@ -273,9 +437,7 @@ static void apply_oprand(irop *op, reg *r)
         panic("Try to apply constant oprand in left");
         break;
     case IRO_Deref:
-        gen_la(temp, op->var->name);
-        gen_lw(temp, temp, 0);
-        gen_sw(r, temp, 0);
+        gen_sw(r, prepare_var(op->var, scratch), 0);
         break;
     case IRO_Ref:
         panic("Try to apply ref oprand in left");
@@ -283,27 +445,31 @@ static void apply_oprand(irop *op, reg *r)
     }
 }
 
-static void gen_store_vars()
+// Only the registers of vars live across the call are saved, the callee
+// may reuse any of them. Vars in memory are safe in this frame.
+static void gen_store_vars(vector *saves)
 {
-    asm_out("# store_vars");
-    reg *r = get_reg();
-    for (int i = 0; i < ast_tree->var_count; i++)
+    if (saves == NULL || saves->len == 0)
+        return;
+    asm_comment("store_vars");
+    reg *fp = get_reg_fp();
+    for (int i = 0; i < saves->len; i++)
     {
-        irvar *var = cast(irvar, vars[i]);
-        prepare_var(var, r);
-        gen_push(r);
+        irvar *var = cast(irvar, saves->data[i]);
+        gen_sw(var_reg(var), fp, allocation->save_offset + 4 * i);
     }
 }
 
-static void gen_load_vars()
+static void gen_load_vars(vector *saves)
 {
-    asm_out("# load_vars");
-    reg *r = get_reg();
-    for (int i = ast_tree->var_count - 1; i >= 0; i--)
+    if (saves == NULL || saves->len == 0)
+        return;
+    asm_comment("load_vars");
+    reg *fp = get_reg_fp();
+    for (int i = 0; i < saves->len; i++)
     {
-        irvar *var = cast(irvar, vars[i]);
-        gen_pop(r);
-        apply_var(var, r);
+        irvar *var = cast(irvar, saves->data[i]);
+        gen_lw(var_reg(var), fp, allocation->save_offset + 4 * i);
     }
 }
 
@@ -318,164 +484,412 @@ static void rewrite_Func(ircode *code)
 {
     asm_log(0, "%s", "Func");
     gen_label(code->label->name);
+    reg *sp = get_reg_sp(), *fp = get_reg_fp();
+    gen_addi(sp, sp, -allocation->frame_size);
+    gen_sw(fp, sp, 0);
+    gen_sw(get_reg_ra(), sp, 4);
+    gen_move(fp, sp);
+    for (int i = 0; i < allocation->callee_count; i++)
+        gen_sw(regs[allocation->callee_regs[i]], fp, allocation->callee_offset + 4 * i);
+    param_count = 0;
 }
 static void rewrite_Assign(ircode *code)
 {
     asm_log(0, "%s", "Assign");
-    reg *right = get_reg();
-    prepare_oprand(code->assign.right, right);
-    apply_oprand(code->assign.left, right);
+    irop *left = code->assign.left;
+    if (left->kind == IRO_Variable)
+    {
+        reg *r = target_var(left->var, get_reg_t8());
+        prepare_oprand_to(code->assign.right, r);
+        apply_var(left->var, r);
+    }
+    else
+    {
+        reg *right = prepare_oprand(code->assign.right, get_reg_t8());
+        apply_oprand(left, right, get_reg_t9());
+    }
+}
+static bool is_const(irop *op)
+{
+    return op->kind == IRO_Constant;
+}
+
+static bool fits_imm(long long value)
+{
+    return value >= -32768 && value <= 32767;
+}
+
+// k if value is 2^k for k > 0, otherwise -1
+static int log2_of(int value)
+{
+    if (value <= 1 || (value & (value - 1)) != 0)
+        return -1;
+    int k = 0;
+    while ((1 << k) != value)
+        k++;
+    return k;
+}
+
+// Folds wrap around like the runtime instructions; unsigned arithmetic
+// keeps them defined in C.
+static int wrap_add(int a, int b)
+{
+    return (int)((unsigned)a + (unsigned)b);
 }
+
+static int wrap_sub(int a, int b)
+{
+    return (int)((unsigned)a - (unsigned)b);
+}
+
+static int wrap_mul(int a, int b)
+{
+    return (int)((unsigned)a * (unsigned)b);
+}
+
+// Writes a constant result of a binary operator.
+static void gen_bop_const(ircode *code, int value)
+{
+    irvar *var = code->bop.target->var;
+    reg *res = target_var(var, get_reg_t8());
+    gen_li(res, value);
+    apply_var(var, res);
+}
+
 static void rewrite_Add(ircode *code)
 {
     asm_log(0, "%s", "Add");
-    reg *op1 = get_reg(), *op2 = get_reg(), *res = get_reg();
-    prepare_oprand(code->bop.op1, op1);
-    prepare_oprand(code->bop.op2, op2);
-    gen_add(res, op1, op2);
-    apply_oprand(code->bop.target, res);
+    irop *a = code->bop.op1, *b = code->bop.op2;
+    if (is_const(a))
+    {
+        irop *t = a;
+        a = b;
+        b = t;
+    }
+    if (is_const(a))
+    {
+        gen_bop_const(code, wrap_add(a->value, b->value));
+        return;
+    }
+    reg *op1 = prepare_oprand(a, get_reg_t8());
+    reg *res = target_var(code->bop.target->var, get_reg_t8());
+    if (is_const(b) && fits_imm(b->value))
+        gen_addi(res, op1, b->value);
+    else
+        gen_add(res, op1, prepare_oprand(b, get_reg_t9()));
+    apply_var(code->bop.target->var, res);
 }
 static void rewrite_Sub(ircode *code)
 {
     asm_log(0, "%s", "Sub");
-    reg *op1 = get_reg(), *op2 = get_reg(), *res = get_reg();
-    prepare_oprand(code->bop.op1, op1);
-    prepare_oprand(code->bop.op2, op2);
-    gen_sub(res, op1, op2);
-    apply_oprand(code->bop.target, res);
+    irop *a = code->bop.op1, *b = code->bop.op2;
+    if (is_const(a) && is_const(b))
+    {
+        gen_bop_const(code, wrap_sub(a->value, b->value));
+        return;
+    }
+    reg *res = target_var(code->bop.target->var, get_reg_t8());
+    if (is_const(b) && fits_imm(-(long long)b->value))
+        gen_addi(res, prepare_oprand(a, get_reg_t8()), -b->value);
+    else if (is_const(a) && a->value == 0)
+        gen_sub(res, get_reg_zero(), prepare_oprand(b, get_reg_t9()));
+    else
+    {
+        reg *op1 = prepare_oprand(a, get_reg_t8());
+        reg *op2 = prepare_oprand(b, get_reg_t9());
+        gen_sub(res, op1, op2);
+    }
+    apply_var(code->bop.target->var, res);
 }
 static void rewrite_Mul(ircode *code)
 {
     asm_log(0, "%s", "Mul");
-    reg *op1 = get_reg(), *op2 = get_reg(), *res = get_reg();
-    prepare_oprand(code->bop.op1, op1);
-    prepare_oprand(code->bop.op2, op2);
-    gen_mul(res, op1, op2);
-    apply_oprand(code->bop.target, res);
+    irop *a = code->bop.op1, *b = code->bop.op2;
+    if (is_const(a))
+    {
+        irop *t = a;
+        a = b;
+        b = t;
+    }
+    if (is_const(a))
+    {
+        gen_bop_const(code, wrap_mul(a->value, b->value));
+        return;
+    }
+    if (is_const(b) && b->value == 0)
+    {
+        gen_bop_const(code, 0);
+        return;
+    }
+    reg *op1 = prepare_oprand(a, get_reg_t8());
+    reg *res = target_var(code->bop.target->var, get_reg_t8());
+    int k = is_const(b) ? log2_of(b->value) : -1;
+    if (is_const(b) && b->value == 1)
+        gen_move(res, op1);
+    else if (is_const(b) && b->value == -1)
+        gen_neg(res, op1);
+    else if (k > 0)
+        gen_sll(res, op1, k);
+    else
+        gen_mul(res, op1, prepare_oprand(b, get_reg_t9()));
+    apply_var(code->bop.target->var, res);
 }
 static void rewrite_Div(ircode *code)
 {
     asm_log(0, "%s", "Div");
-    reg *op1 = get_reg(), *op2 = get_reg(), *res = get_reg();
-    prepare_oprand(code->bop.op1, op1);
-    prepare_oprand(code->bop.op2, op2);
-    gen_div(res, op1, op2);
-    apply_oprand(code->bop.target, res);
+    irop *a = code->bop.op1, *b = code->bop.op2;
+    if (is_const(a) && is_const(b) && b->value != 0 && !(a->value == (int)0x80000000 && b->value == -1))
+    {
+        gen_bop_const(code, a->value / b->value);
+        return;
+    }
+    reg *op1 = prepare_oprand(a, get_reg_t8());
+    reg *res = target_var(code->bop.target->var, get_reg_t8());
+    int k = is_const(b) ? log2_of(b->value) : -1;
+    if (is_const(b) && b->value == 1)
+        gen_move(res, op1);
+    else if (is_const(b) && b->value == -1)
+        gen_neg(res, op1);
+    else if (k > 0)
+    {
+        // division truncates toward zero, so negative values are biased
+        // by 2^k - 1 before the arithmetic shift
+        reg *bias = get_reg_t9();
+        if (k == 1)
+            gen_srl(bias, op1, 31);
+        else
+        {
+            gen_sra(bias, op1, 31);
+            gen_srl(bias, bias, 32 - k);
+        }
+        gen_add(bias, op1, bias);
+        gen_sra(res, bias, k);
+    }
+    else
+        gen_div(res, op1, prepare_oprand(b, get_reg_t9()));
+    apply_var(code->bop.target->var, res);
 }
 static void rewrite_Goto(ircode *code)
 {
     asm_log(0, "%s", "Goto");
     gen_j(code->label->name);
 }
+// relop' with (b relop' a) == (a relop b)
+static relop_type swap_relop(relop_type relop)
+{
+    switch (relop)
+    {
+    case RT_L:
+        return RT_S;
+    case RT_S:
+        return RT_L;
+    case RT_LE:
+        return RT_SE;
+    case RT_SE:
+        return RT_LE;
+    default:
+        return relop;
+    }
+}
+static void gen_branch_zero(reg *op, relop_type relop, const char *label)
+{
+    switch (relop)
+    {
+    case RT_L:
+        gen_bgtz(op, label);
+        break;
+    case RT_S:
+        gen_bltz(op, label);
+        break;
+    case RT_LE:
+        gen_bgez(op, label);
+        break;
+    case RT_SE:
+        gen_blez(op, label);
+        break;
+    case RT_E:
+        gen_beqz(op, label);
+        break;
+    case RT_NE:
+        gen_bnez(op, label);
+        break;
+    }
+}
+// Branches on op < value with slti, false if relop has no such form.
+static bool gen_branch_slti(reg *op, relop_type relop, int constant, const char *label)
+{
+    long long value = constant;
+    // op > v is !(op < v + 1) and op <= v is op < v + 1
+    bool less;
+    switch (relop)
+    {
+    case RT_S:
+        less = true;
+        break;
+    case RT_LE:
+        less = false;
+        break;
+    case RT_L:
+        less = false;
+        value++;
+        break;
+    case RT_SE:
+        less = true;
+        value++;
+        break;
+    default:
+        return false;
+    }
+    if (!fits_imm(value))
+        return false;
+    reg *flag = get_reg_t9();
+    gen_slti(flag, op, value);
+    if (less)
+        gen_bnez(flag, label);
+    else
+        gen_beqz(flag, label);
+    return true;
+}
 static void rewrite_Branch(ircode *code)
 {
     asm_log(0, "%s", "Branch");
-    reg *op1 = get_reg(), *op2 = get_reg();
-    prepare_oprand(code->branch.op1, op1);
-    prepare_oprand(code->branch.op2, op2);
-    switch (code->branch.relop)
+    irop *a = code->branch.op1, *b = code->branch.op2;
+    relop_type relop = code->branch.relop;
+    const char *label = code->branch.target->name;
+    if (is_const(a) && !is_const(b))
+    {
+        irop *t = a;
+        a = b;
+        b = t;
+        relop = swap_relop(relop);
+    }
+    reg *op1 = prepare_oprand(a, get_reg_t8());
+    if (is_const(b) && b->value == 0)
+    {
+        gen_branch_zero(op1, relop, label);
+        return;
+    }
+    if (is_const(b) && gen_branch_slti(op1, relop, b->value, label))
+        return;
+    reg *op2 = prepare_oprand(b, get_reg_t9());
+    switch (relop)
     {
     case RT_L: // >
-        gen_bgt(op1, op2, code->branch.target->name);
+        gen_bgt(op1, op2, label);
         break;
     case RT_S: // <
-        gen_blt(op1, op2, code->branch.target->name);
+        gen_blt(op1, op2, label);
         break;
     case RT_LE: // >=
-        gen_bge(op1, op2, code->branch.target->name);
+        gen_bge(op1, op2, label);
         break;
     case RT_SE: // <=
-        gen_ble(op1, op2, code->branch.target->name);
+        gen_ble(op1, op2, label);
         break;
     case RT_E: // ==
-        gen_beq(op1, op2, code->branch.target->name);
+        gen_beq(op1, op2, label);
         break;
     case RT_NE: // !=
-        gen_bne(op1, op2, code->branch.target->name);
+        gen_bne(op1, op2, label);
         break;
     }
 }
 static void rewrite_Return(ircode *code)
 {
     asm_log(0, "%s", "Return");
-    prepare_oprand(code->ret, get_reg_v0());
-    gen_jr(get_reg_ra());
+    prepare_oprand_to(code->ret, get_reg_v0());
+    reg *sp = get_reg_sp(), *fp = get_reg_fp(), *ra = get_reg_ra();
+    for (int i = 0; i < allocation->callee_count; i++)
+        gen_lw(regs[allocation->callee_regs[i]], fp, allocation->callee_offset + 4 * i);
+    gen_addi(sp, fp, allocation->frame_size);
+    gen_lw(ra, fp, 4);
+    gen_lw(fp, fp, 0);
+    gen_jr(ra);
 }
 static void rewrite_Dec(ircode *code)
 {
     asm_log(0, "%s", "Dec");
-    reg *sp = get_reg_sp(), *r = get_reg();
-    gen_li(r, code->dec.size);
-    gen_sub(sp, sp, r);
-    apply_oprand(code->dec.op, sp);
+    irvar *var = code->dec.op->var;
+    reg *r = target_var(var, get_reg_t8());
+    gen_addi(r, get_reg_fp(), allocation->array_of[var->id]);
+    apply_var(var, r);
 }
 static bool is_incall = false;
-static void prepare_call()
+static vector *call_saves = NULL;
+// args of the current call, and the args not passed yet, ARGs come last
+// arg first
+static int arg_count = 0, arg_left = 0;
+static void prepare_call(int index)
 {
     if (!is_incall)
     {
-        gen_store_vars();
-        reg *ra = get_reg_ra(), *fp = get_reg_fp(), *sp = get_reg_sp();
-        gen_push(ra);
-        gen_push(fp);
-        gen_move(fp, sp);
+        arg_count = 0;
+        for (;; index++)
+        {
+            ircode *code = cast(ircode, ast_tree->codes[index]);
+            if (code->ignore)
+                continue;
+            if (code->kind == IR_Call)
+                break;
+            if (code->kind == IR_Arg)
+                arg_count++;
+        }
+        arg_left = arg_count;
+        call_saves = allocation->saves[index];
+        gen_store_vars(call_saves);
         is_incall = true;
     }
 }
 static void end_call()
 {
     Assert(is_incall, "Not incall");
-    reg *ra = get_reg_ra(), *fp = get_reg_fp(), *sp = get_reg_sp();
-    gen_move(sp, fp);
-    gen_pop(fp);
-    gen_pop(ra);
-    gen_load_vars();
+    if (arg_count > ARG_REGS)
+        gen_addi(get_reg_sp(), get_reg_sp(), 4 * (arg_count - ARG_REGS));
+    gen_load_vars(call_saves);
     is_incall = false;
 }
-static void rewrite_Arg(ircode *code)
+static void rewrite_Arg(ircode *code, int index)
 {
     asm_log(0, "%s", "Arg");
-    prepare_call();
-    reg *r = get_reg();
-    prepare_oprand(code->arg, r);
-    gen_push(r);
+    prepare_call(index);
+    int arg = --arg_left;
+    if (arg < ARG_REGS)
+        prepare_oprand_to(code->arg, get_reg_arg(arg));
+    else
+        gen_push(prepare_oprand(code->arg, get_reg_t8()));
 }
-static void rewrite_Call(ircode *code)
+static void rewrite_Call(ircode *code, int index)
 {
     asm_log(0, "%s", "Call");
-    prepare_call();
+    prepare_call(index);
     gen_jal(code->call.func->name);
     end_call();
-    reg *res = get_reg();
-    gen_move(res, get_reg_v0());
-    apply_oprand(code->call.ret, res);
+    apply_var(code->call.ret->var, get_reg_v0());
 }
 static void rewrite_Param(ircode *code)
 {
     asm_log(0, "%s", "Param");
-    reg *r = get_reg();
-    gen_pop(r);
-    apply_oprand(code->param, r);
+    int param = param_count++;
+    if (param < ARG_REGS)
+    {
+        apply_var(code->param->var, get_reg_arg(param));
+        return;
+    }
+    reg *r = target_var(code->param->var, get_reg_t8());
+    gen_lw(r, get_reg_fp(), allocation->frame_size + 4 * (param - ARG_REGS));
+    apply_var(code->param->var, r);
 }
 static void rewrite_Read(ircode *code)
 {
     asm_log(0, "%s", "Read");
-    reg *ra = get_reg_ra();
-    gen_push(ra);
     gen_jal("read");
-    gen_pop(ra);
-    apply_oprand(code->read, get_reg_v0());
+    apply_var(code->read->var, get_reg_v0());
 }
 static void rewrite_Write(ircode *code)
 {
     asm_log(0, "%s", "Write");
-    reg *ra = get_reg_ra();
-    reg *r = get_reg();
-    prepare_oprand(code->write, r);
-    gen_move(get_reg_a0(), r);
-    gen_push(ra);
+    prepare_oprand_to(code->write, get_reg_a0());
     gen_jal("write");
-    gen_pop(ra);
 }
 
 void asm_error(int type, int lineno, char *format, ...)
@@ -488,7 +902,7 @@ void asm_error(int type, int lineno, char *format, ...)
     int ret;
 
     va_start(aptr, format);
-    vsprintf(asm_buffer, format, aptr);
+    vsnprintf(asm_buffer, sizeof(asm_buffer), format, aptr);
     va_end(aptr);
 
     fprintf(stderr, "%s.\n", asm_buffer);
@@ -502,7 +916,7 @@ void asm_log(int lineno, char *format, ...)
     int ret;
 
     va_start(aptr, format);
-    vsprintf(asm_buffer, format, aptr);
+    vsnprintf(asm_buffer, sizeof(asm_buffer), format, aptr);
     va_end(aptr);
 
 #endif
@@ -513,196 +927,158 @@ void asm_log(int lineno, char *format, ...)
 void asm_prepare(FILE *output)
 {
     asm_is_passed = true;
-    asm_output = output;
+    asm_writer = new_writer(output);
+    asm_code = new_mips_list();
     for (int i = 0; i < 32; i++)
         regs[i] = new_reg(i);
 }
 
-bool asm_has_passed()
+void asm_set_comments(bool enabled)
 {
-    return asm_is_passed;
+    asm_comments = enabled;
 }
 
-static void printHeader(ast *tree)
+void asm_set_source_map(FILE *output)
 {
-    fputs(".data\n", asm_output);
-    fputs("_prompt: .asciiz \"Enter an integer:\"\n", asm_output);
-    fputs("_ret: .asciiz \"\\n\"\n", asm_output);
+    map_writer = new_writer(output);
+    writer_str(map_writer, "# asm ir cmm\n");
+}
 
-    for (list *l = tree->vars; l != NULL; l = l->next)
+bool asm_has_passed()
+{
+    return asm_is_passed;
+}
+
+static const char *header[] = {
+    ".data",
+    "_prompt: .asciiz \"Enter an integer:\"",
+    "_ret: .asciiz \"\\n\"",
+    ".globl main",
+    ".text",
+    "read:",
+    "  li $v0, 4",
+    "  la $a0, _prompt",
+    "  syscall",
+    "  li $v0, 5",
+    "  syscall",
+    "  jr $ra",
+    "",
+    "write:",
+    "  li $v0, 1",
+    "  syscall",
+    "  li $v0, 4",
+    "  la $a0, _ret",
+    "  syscall",
+    "  move $v0, $0",
+    "  jr $ra",
+    "",
+};
+
+static void printHeader()
+{
+    for (size_t i = 0; i < sizeof(header) / sizeof(header[0]); i++)
     {
-        irvar *var = cast(irvar, l->obj);
-        asm_out("%s: .word 0", var->name);
+        writer_str(asm_writer, header[i]);
+        writer_char(asm_writer, '\n');
+        asm_line++;
     }
+}
 
-    fputs(".globl main\n", asm_output);
-    fputs(".text\n", asm_output);
-    fputs("read:\n", asm_output);
-    fputs("  li $v0, 4\n", asm_output);
-    fputs("  la $a0, _prompt\n", asm_output);
-    fputs("  syscall\n", asm_output);
-    fputs("  li $v0, 5\n", asm_output);
-    fputs("  syscall\n", asm_output);
-    fputs("  jr $ra\n", asm_output);
-    fputs("\n", asm_output);
-    fputs("write:\n", asm_output);
-    fputs("  li $v0, 1\n", asm_output);
-    fputs("  syscall\n", asm_output);
-    fputs("  li $v0, 4\n", asm_output);
-    fputs("  la $a0, _ret\n", asm_output);
-    fputs("  syscall\n", asm_output);
-    fputs("  move $v0, $0\n", asm_output);
-    fputs("  jr $ra\n", asm_output);
-
-    fputs("\n", asm_output);
-}
-
-static void printOprand(irop *op, FILE *file)
+// Ends the range of the previous IR code, skipped if it produced no lines
+static void map_close()
 {
-    switch (op->kind)
-    {
-    case IRO_Variable:
-        fprintf(asm_output, "%s", op->var->name);
-        break;
-    case IRO_Constant:
-        fprintf(asm_output, "#%d", op->value);
-        break;
-    case IRO_Deref:
-        fprintf(asm_output, "*%s", op->var->name);
-        break;
-    case IRO_Ref:
-        fprintf(asm_output, "&%s", op->var->name);
-        break;
-    }
+    if (map_writer == NULL || map_ir_line == 0 || asm_line < map_first)
+        return;
+    writer *w = map_writer;
+    writer_int(w, map_first);
+    writer_char(w, '-');
+    writer_int(w, asm_line);
+    writer_char(w, ' ');
+    writer_int(w, map_ir_line);
+    writer_char(w, ' ');
+    writer_int(w, map_src_line);
+    writer_char(w, '\n');
 }
 
-static void asm_ir_comment(ircode *code, FILE *file)
+static void asm_flush()
 {
-    fprintf(file, "# ");
-    switch (code->kind)
+    peephole_run(asm_code);
+    for (int i = 0; i < asm_code->len; i++)
     {
-    case IR_Label:
-        fprintf(file, "LABEL %s :\n", code->label->name);
-        break;
-    case IR_Func:
-        fprintf(file, "FUNCTION %s :\n", code->label->name);
-        break;
-    case IR_Assign:
-        printOprand(code->assign.left, file);
-        fprintf(file, " := ");
-        printOprand(code->assign.right, file);
-        fprintf(file, "\n");
-        break;
-    case IR_Add:
-        printOprand(code->bop.target, file);
-        fprintf(file, " := ");
-        printOprand(code->bop.op1, file);
-        fprintf(file, " + ");
-        printOprand(code->bop.op2, file);
-        fprintf(file, "\n");
-        break;
-    case IR_Sub:
-        printOprand(code->bop.target, file);
-        fprintf(file, " := ");
-        printOprand(code->bop.op1, file);
-        fprintf(file, " - ");
-        printOprand(code->bop.op2, file);
-        fprintf(file, "\n");
-        break;
-    case IR_Mul:
-        printOprand(code->bop.target, file);
-        fprintf(file, " := ");
-        printOprand(code->bop.op1, file);
-        fprintf(file, " * ");
-        printOprand(code->bop.op2, file);
-        fprintf(file, "\n");
-        break;
-    case IR_Div:
-        printOprand(code->bop.target, file);
-        fprintf(file, " := ");
-        printOprand(code->bop.op1, file);
-        fprintf(file, " / ");
-        printOprand(code->bop.op2, file);
-        fprintf(file, "\n");
-        break;
-    case IR_Goto:
-        fprintf(file, "GOTO %s\n", code->label->name);
-        break;
-    case IR_Branch:
-        fprintf(file, "IF ");
-        printOprand(code->branch.op1, file);
-        switch (code->branch.relop)
+        mips_instr *in = &asm_code->data[i];
+        if (in->dead)
+            continue;
+        if (in->op == MI_IRComment)
         {
-        case RT_L:
-            fprintf(file, " > ");
-            break;
-        case RT_S:
-            fprintf(file, " < ");
-            break;
-        case RT_LE:
-            fprintf(file, " >= ");
-            break;
-        case RT_SE:
-            fprintf(file, " <= ");
-            break;
-        case RT_E:
-            fprintf(file, " == ");
-            break;
-        case RT_NE:
-            fprintf(file, " != ");
-            break;
+            ircode *code = cast(ircode, in->code);
+            map_close();
+            if (asm_comments)
+            {
+                writer_str(asm_writer, "# ");
+                ir_write_code(asm_writer, code);
+                asm_line++;
+            }
+            map_first = asm_line + 1;
+            map_ir_line = in->imm;
+            map_src_line = code->lineno;
+            continue;
         }
-        printOprand(code->branch.op2, file);
-        fprintf(file, " GOTO %s", code->branch.target->name);
-        fprintf(file, "\n");
-        break;
-    case IR_Return:
-        fprintf(file, "RETURN ");
-        printOprand(code->ret, file);
-        fprintf(file, "\n");
-        break;
-    case IR_Dec:
-        fprintf(file, "DEC %s %d\n", code->dec.op->var->name, code->dec.size);
-        break;
-    case IR_Arg:
-        fprintf(file, "ARG ");
-        printOprand(code->arg, file);
-        fprintf(file, "\n");
-        break;
-    case IR_Call:
-        fprintf(file, "%s := CALL %s\n", code->call.ret->var->name, code->call.func->name);
-        break;
-    case IR_Param:
-        fprintf(file, "PARAM %s\n", code->param->var->name);
-        break;
-    case IR_Read:
-        fprintf(file, "READ %s\n", code->read->var->name);
-        break;
-    case IR_Write:
-        fprintf(file, "WRITE ");
-        printOprand(code->write, file);
-        fprintf(file, "\n");
-        break;
+        if (in->op == MI_Comment && !asm_comments)
+            continue;
+        mips_print(in, asm_writer);
+        asm_line++;
+    }
+    mips_clear(asm_code);
+}
+
+static void print_peephole_summary()
+{
+    if (!asm_comments)
+        return;
+    int total = 0;
+    for (int i = 0; i < PH_COUNT; i++)
+        total += peephole_removed[i];
+    writer *w = asm_writer;
+    writer_str(w, "\n# peephole removed ");
+    writer_int(w, total);
+    writer_str(w, " instructions\n");
+    for (int i = 0; i < PH_COUNT; i++)
+    {
+        if (peephole_removed[i] == 0)
+            continue;
+        writer_str(w, "#   ");
+        writer_str(w, peephole_names[i]);
+        writer_str(w, ": ");
+        writer_int(w, peephole_removed[i]);
+        writer_char(w, '\n');
     }
 }
 
 void asm_generate(ast *tree)
 {
     ast_tree = tree;
-    vars = list_revto_arr(tree->vars);
-    printHeader(tree);
+    cfg *g = cfg_build(tree);
+    allocation = regalloc_new(tree, caller_saved, sizeof(caller_saved) / sizeof(int), callee_saved, sizeof(callee_saved) / sizeof(int));
+    int func_index = 0;
+    int ir_line = 0;
+    printHeader();
     for (int i = 0; i < tree->len; i++)
     {
         ircode *code = cast(ircode, tree->codes[i]);
         if (code->ignore)
             continue;
-        asm_ir_comment(code, asm_output);
+        if (code->kind == IR_Func)
+            asm_flush();
+        mips_instr *marker = asm_emit(MI_IRComment);
+        marker->code = code;
+        marker->imm = ++ir_line;
         switch (code->kind)
         {
         case IR_Label:
             rewrite_Label(code);
             break;
         case IR_Func:
+            regalloc_func(allocation, g->funcs[func_index++], FRAME_RESERVED);
             rewrite_Func(code);
             break;
         case IR_Assign:
@@ -733,10 +1109,10 @@ void asm_generate(ast *tree)
             rewrite_Dec(code);
             break;
         case IR_Arg:
-            rewrite_Arg(code);
+            rewrite_Arg(code, i);
             break;
         case IR_Call:
-            rewrite_Call(code);
+            rewrite_Call(code, i);
             break;
         case IR_Param:
             rewrite_Param(code);
@@ -749,4 +1125,10 @@ void asm_generate(ast *tree)
             break;
         }
     }
+    asm_flush();
+    map_close();
+    print_peephole_summary();
+    writer_flush(asm_writer);
+    if (map_writer != NULL)
+        writer_flush(map_writer);
 }
@@ -5,6 +5,13 @@
 
 void asm_prepare(FILE* output);
 
+// Write each IR code as a comment above its instructions, on by default
+void asm_set_comments(bool enabled);
+
+// Also write "first-last ir cmm" lines mapping asm line ranges back to the
+// IR line (as printed by --ir) and the C-- line they came from
+void asm_set_source_map(FILE* output);
+
 void asm_generate(ast* tree);
 
 bool asm_has_passed();
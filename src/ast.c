@@ -6,36 +6,84 @@
 #include "object.h"
 #include "debug.h"
 
-irop *op_var(irvar *var)
+static irop *new_var_op(irop_type kind, irvar *var)
 {
     irop *op = new (irop);
-    op->kind = IRO_Variable;
+    op->kind = kind;
     op->var = var;
     return op;
 }
 
+irop *op_var(irvar *var)
+{
+    if (var->as_var == NULL)
+        var->as_var = new_var_op(IRO_Variable, var);
+    return var->as_var;
+}
+
 irop *op_ref(irvar *var)
 {
-    irop *op = new (irop);
-    op->kind = IRO_Ref;
-    op->var = var;
-    return op;
+    if (var->as_ref == NULL)
+        var->as_ref = new_var_op(IRO_Ref, var);
+    return var->as_ref;
 }
 
 irop *op_deref(irvar *var)
 {
-    irop *op = new (irop);
-    op->kind = IRO_Deref;
-    op->var = var;
-    return op;
+    if (var->as_deref == NULL)
+        var->as_deref = new_var_op(IRO_Deref, var);
+    return var->as_deref;
+}
+
+// Constants outlive every arena, so a table of them can be kept for the
+// whole run. Open addressing on the value, at most half full.
+static irop **const_ops = NULL;
+static int const_slot_count = 0, const_count = 0;
+
+static int const_slot(irop **slots, int slot_count, int value)
+{
+    int mask = slot_count - 1;
+    int i = ((unsigned int)value * 2654435761u) >> 8 & mask;
+    while (slots[i] != NULL && slots[i]->value != value)
+        i = (i + 1) & mask;
+    return i;
+}
+
+static void const_grow()
+{
+    int slot_count = const_slot_count == 0 ? 256 : const_slot_count * 2;
+    irop **slots = newarr(irop, slot_count);
+    for (int k = 0; k < const_slot_count; k++)
+    {
+        if (const_ops[k] != NULL)
+            slots[const_slot(slots, slot_count, const_ops[k]->value)] = const_ops[k];
+    }
+    if (const_ops != NULL)
+        delete (const_ops);
+    const_ops = slots;
+    const_slot_count = slot_count;
 }
 
 irop *op_const(int value)
 {
-    irop *op = new (irop);
-    op->kind = IRO_Constant;
-    op->value = value;
-    return op;
+    if (2 * (const_count + 1) > const_slot_count)
+    {
+        arena_phase last = arena_enter(ARENA_NONE);
+        const_grow();
+        arena_enter(last);
+    }
+    int i = const_slot(const_ops, const_slot_count, value);
+    if (const_ops[i] == NULL)
+    {
+        arena_phase last = arena_enter(ARENA_NONE);
+        irop *op = new (irop);
+        arena_enter(last);
+        op->kind = IRO_Constant;
+        op->value = value;
+        const_ops[i] = op;
+        const_count++;
+    }
+    return const_ops[i];
 }
 
 irop *op_rval(irvar *var)
@@ -74,7 +74,7 @@ typedef relop_type sytd_relop;
 
 typedef metatype_type sytd_type;
 
-typedef char sytd_id[64];
+typedef const char *sytd_id;
 
 typedef struct __syntax_tree
 {
@@ -126,19 +126,24 @@ typedef enum
 typedef struct
 {
     int id;
-    char name[64];
+    const char *name;
     bool isref;
     int usedTime;
     int assignTime;
     void *usedCode;
+    // the operands op_var, op_ref and op_deref share, made on first use
+    struct __irop *as_var, *as_ref, *as_deref;
 } irvar;
 
 typedef struct
 {
-    char name[64];
+    const char *name;
 } irlabel;
 
-typedef struct
+// Operands are shared and never changed: op_var(v) always returns the same
+// irop, and so do op_ref, op_deref and op_const for one value, so operands
+// compare by pointer. Replace an operand, do not write to it.
+typedef struct __irop
 {
     irop_type kind;
     union {
@@ -161,6 +166,7 @@ typedef struct
 {
     irc_type kind;
     bool ignore;
+    int lineno; // C-- line the code was translated from
     union {
         struct
         {
@@ -200,7 +206,7 @@ typedef struct
     int len;
     int var_count;
     void **codes;
-    list *vars;
+    vector *vars;
 } ast;
 
 #endif
\ No newline at end of file
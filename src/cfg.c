@@ -0,0 +1,404 @@
+#include <stdlib.h>
+#include "cfg.h"
+#include "object.h"
+#include "hash.h"
+#include "debug.h"
+
+// Label names are interned, so the name pointer is the key.
+static const char **label_keys = NULL;
+static basic_block **label_blocks = NULL;
+static int label_slot_count = 0;
+
+static int label_slot(const char *name)
+{
+    int mask = label_slot_count - 1;
+    int i = hash_pointer(name) & mask;
+    while (label_keys[i] != NULL && label_keys[i] != name)
+        i = (i + 1) & mask;
+    return i;
+}
+
+static basic_block *label_block(irlabel *label)
+{
+    int i = label_slot(label->name);
+    Assert(label_keys[i] != NULL, "jump to unknown label %s", label->name);
+    return label_blocks[i];
+}
+
+static ircode *code_at(ast *tree, int index)
+{
+    return cast(ircode, tree->codes[index]);
+}
+
+static bool is_jump(ircode *code)
+{
+    return code->kind == IR_Goto || code->kind == IR_Branch || code->kind == IR_Return;
+}
+
+static basic_block *new_block(int id, int begin)
+{
+    basic_block *result = new (basic_block);
+    result->id = id;
+    result->begin = begin;
+    result->end = begin;
+    result->succ_count = 0;
+    result->pred_count = 0;
+    result->preds = NULL;
+    result->rpo = -1;
+    result->idom = NULL;
+    result->loop = NULL;
+    return result;
+}
+
+static void add_succ(basic_block *from, basic_block *to)
+{
+    for (int i = 0; i < from->succ_count; i++)
+    {
+        if (from->succs[i] == to)
+            return;
+    }
+    from->succs[from->succ_count++] = to;
+}
+
+// A new block starts at the first code, at a label following real codes,
+// and after every jump. Runs of labels share one block.
+static void split_blocks(cfg *g, cfg_func *func)
+{
+    ast *tree = g->tree;
+    vector *blocks = new_vector();
+    basic_block *cur = NULL;
+    bool has_body = false, ended = false;
+    for (int i = func->begin; i < func->end; i++)
+    {
+        ircode *code = code_at(tree, i);
+        if (code->ignore)
+            continue;
+        bool is_label = code->kind == IR_Label || code->kind == IR_Func;
+        if (cur == NULL || ended || (is_label && has_body))
+        {
+            cur = new_block(blocks->len, i);
+            vector_push(blocks, cur);
+            has_body = false;
+            ended = false;
+        }
+        cur->end = i + 1;
+        g->block_of[i] = cur;
+        if (is_label)
+        {
+            if (code->kind == IR_Label)
+            {
+                int slot = label_slot(code->label->name);
+                label_keys[slot] = code->label->name;
+                label_blocks[slot] = cur;
+            }
+        }
+        else
+            has_body = true;
+        ended = is_jump(code);
+    }
+    func->block_count = blocks->len;
+    func->blocks = (basic_block **)blocks->data;
+}
+
+static void link_blocks(cfg *g, cfg_func *func)
+{
+    for (int i = 0; i < func->block_count; i++)
+    {
+        basic_block *b = func->blocks[i];
+        basic_block *next = i + 1 < func->block_count ? func->blocks[i + 1] : NULL;
+        ircode *last = code_at(g->tree, b->end - 1);
+        switch (last->kind)
+        {
+        case IR_Goto:
+            add_succ(b, label_block(last->label));
+            break;
+        case IR_Branch:
+            if (next != NULL)
+                add_succ(b, next);
+            add_succ(b, label_block(last->branch.target));
+            break;
+        case IR_Return:
+            break;
+        default:
+            if (next != NULL)
+                add_succ(b, next);
+            break;
+        }
+    }
+
+    for (int i = 0; i < func->block_count; i++)
+    {
+        basic_block *b = func->blocks[i];
+        for (int j = 0; j < b->succ_count; j++)
+            b->succs[j]->pred_count++;
+    }
+    for (int i = 0; i < func->block_count; i++)
+    {
+        basic_block *b = func->blocks[i];
+        b->preds = newarr(basic_block, b->pred_count == 0 ? 1 : b->pred_count);
+        b->pred_count = 0;
+    }
+    for (int i = 0; i < func->block_count; i++)
+    {
+        basic_block *b = func->blocks[i];
+        for (int j = 0; j < b->succ_count; j++)
+        {
+            basic_block *s = b->succs[j];
+            s->preds[s->pred_count++] = b;
+        }
+    }
+}
+
+static void number_blocks(cfg_func *func)
+{
+    int n = func->block_count;
+    basic_block **stack = newarr(basic_block, n);
+    int *next = newvalarr(int, n);
+    bool *seen = newvalarr(bool, n);
+    basic_block **post = newarr(basic_block, n);
+    for (int i = 0; i < n; i++)
+    {
+        next[i] = 0;
+        seen[i] = false;
+    }
+
+    // iterative DFS, big functions would overflow the C stack
+    int top = 0, count = 0;
+    stack[top++] = func->blocks[0];
+    seen[0] = true;
+    while (top > 0)
+    {
+        basic_block *b = stack[top - 1];
+        if (next[b->id] < b->succ_count)
+        {
+            basic_block *s = b->succs[next[b->id]++];
+            if (!seen[s->id])
+            {
+                seen[s->id] = true;
+                stack[top++] = s;
+            }
+        }
+        else
+        {
+            post[count++] = b;
+            top--;
+        }
+    }
+
+    func->order_count = count;
+    func->order = newarr(basic_block, count);
+    for (int i = 0; i < count; i++)
+    {
+        basic_block *b = post[count - 1 - i];
+        b->rpo = i;
+        func->order[i] = b;
+    }
+
+    delete (stack);
+    delete (next);
+    delete (seen);
+    delete (post);
+}
+
+static basic_block *intersect(basic_block *a, basic_block *b)
+{
+    while (a != b)
+    {
+        while (a->rpo > b->rpo)
+            a = a->idom;
+        while (b->rpo > a->rpo)
+            b = b->idom;
+    }
+    return a;
+}
+
+// Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm".
+static void find_dominators(cfg_func *func)
+{
+    basic_block *entry = func->order[0];
+    entry->idom = entry;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int i = 1; i < func->order_count; i++)
+        {
+            basic_block *b = func->order[i];
+            basic_block *idom = NULL;
+            for (int j = 0; j < b->pred_count; j++)
+            {
+                basic_block *p = b->preds[j];
+                if (p->idom == NULL)
+                    continue;
+                idom = idom == NULL ? p : intersect(p, idom);
+            }
+            if (b->idom != idom)
+            {
+                b->idom = idom;
+                changed = true;
+            }
+        }
+    }
+}
+
+static int loop_cmp(const void *a, const void *b)
+{
+    const cfg_loop *la = *(const cfg_loop **)a;
+    const cfg_loop *lb = *(const cfg_loop **)b;
+    if (la->block_count != lb->block_count)
+        return lb->block_count - la->block_count;
+    return la->header->rpo - lb->header->rpo;
+}
+
+// Natural loops of back edges; back edges to one header share a loop.
+static void find_loops(cfg_func *func)
+{
+    int n = func->block_count;
+    vector **bodies = newarr(vector, n);
+    int *mark = newvalarr(int, n);
+    basic_block **stack = newarr(basic_block, n);
+    for (int i = 0; i < n; i++)
+    {
+        bodies[i] = NULL;
+        mark[i] = -1;
+    }
+
+    vector *headers = new_vector();
+    for (int i = 0; i < func->order_count; i++)
+    {
+        basic_block *h = func->order[i];
+        int top = 0;
+        for (int j = 0; j < h->pred_count; j++)
+        {
+            basic_block *t = h->preds[j];
+            if (!cfg_dominates(h, t))
+                continue;
+            if (bodies[h->id] == NULL)
+            {
+                bodies[h->id] = new_vector();
+                vector_push(bodies[h->id], h);
+                mark[h->id] = h->id;
+                vector_push(headers, h);
+            }
+            if (mark[t->id] != h->id)
+            {
+                mark[t->id] = h->id;
+                vector_push(bodies[h->id], t);
+                stack[top++] = t;
+            }
+        }
+        while (top > 0)
+        {
+            basic_block *b = stack[--top];
+            for (int k = 0; k < b->pred_count; k++)
+            {
+                basic_block *p = b->preds[k];
+                if (p->rpo < 0 || mark[p->id] == h->id)
+                    continue;
+                mark[p->id] = h->id;
+                vector_push(bodies[h->id], p);
+                stack[top++] = p;
+            }
+        }
+    }
+
+    func->loop_count = headers->len;
+    func->loops = newarr(cfg_loop, headers->len == 0 ? 1 : headers->len);
+    for (int i = 0; i < headers->len; i++)
+    {
+        basic_block *h = cast(basic_block, headers->data[i]);
+        cfg_loop *loop = new (cfg_loop);
+        loop->header = h;
+        loop->parent = NULL;
+        loop->depth = 1;
+        loop->block_count = bodies[h->id]->len;
+        loop->blocks = (basic_block **)bodies[h->id]->data;
+        func->loops[i] = loop;
+    }
+
+    // Natural loops either nest or are disjoint, so after sorting by size
+    // the innermost loop seen so far around a header is its parent.
+    qsort(func->loops, func->loop_count, sizeof(cfg_loop *), loop_cmp);
+    for (int i = 0; i < func->loop_count; i++)
+    {
+        cfg_loop *loop = func->loops[i];
+        loop->parent = loop->header->loop;
+        loop->depth = loop->parent == NULL ? 1 : loop->parent->depth + 1;
+        for (int j = 0; j < loop->block_count; j++)
+            loop->blocks[j]->loop = loop;
+    }
+
+    delete (bodies);
+    delete (mark);
+    delete (stack);
+}
+
+cfg *cfg_build(ast *tree)
+{
+    cfg *result = new (cfg);
+    result->tree = tree;
+    result->block_of = newarr(basic_block, tree->len == 0 ? 1 : tree->len);
+
+    int label_count = 0;
+    vector *funcs = new_vector();
+    for (int i = 0; i < tree->len; i++)
+    {
+        ircode *code = code_at(tree, i);
+        result->block_of[i] = NULL;
+        if (code->ignore)
+            continue;
+        if (code->kind == IR_Label)
+            label_count++;
+        else if (code->kind == IR_Func)
+        {
+            cfg_func *func = new (cfg_func);
+            func->name = code->label;
+            func->begin = i;
+            func->end = tree->len;
+            if (funcs->len > 0)
+                cast(cfg_func, funcs->data[funcs->len - 1])->end = i;
+            vector_push(funcs, func);
+        }
+    }
+    result->func_count = funcs->len;
+    result->funcs = (cfg_func **)funcs->data;
+
+    label_slot_count = 16;
+    while (label_slot_count < label_count * 2)
+        label_slot_count <<= 1;
+    label_keys = (const char **)newarr(char, label_slot_count);
+    label_blocks = newarr(basic_block, label_slot_count);
+    for (int i = 0; i < label_slot_count; i++)
+        label_keys[i] = NULL;
+
+    for (int i = 0; i < result->func_count; i++)
+        split_blocks(result, result->funcs[i]);
+    for (int i = 0; i < result->func_count; i++)
+    {
+        cfg_func *func = result->funcs[i];
+        link_blocks(result, func);
+        number_blocks(func);
+        find_dominators(func);
+        find_loops(func);
+    }
+
+    delete (label_keys);
+    delete (label_blocks);
+    label_keys = NULL;
+    label_blocks = NULL;
+    return result;
+}
+
+bool cfg_dominates(basic_block *a, basic_block *b)
+{
+    if (a->rpo < 0 || b->rpo < 0)
+        return false;
+    while (b->rpo > a->rpo)
+        b = b->idom;
+    return a == b;
+}
+
+int cfg_loop_depth(basic_block *b)
+{
+    return b->loop == NULL ? 0 : b->loop->depth;
+}
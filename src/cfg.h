@@ -0,0 +1,64 @@
+#ifndef __CFG_H__
+#define __CFG_H__
+
+#include "common.h"
+#include "ast.h"
+
+struct __cfg_loop;
+
+typedef struct __basic_block
+{
+    int id;
+    // codes [begin, end) of ast.codes, ignored codes included
+    int begin, end;
+    int succ_count;
+    struct __basic_block *succs[2];
+    int pred_count;
+    struct __basic_block **preds;
+    // index in reverse postorder, -1 if unreachable from the entry
+    int rpo;
+    struct __basic_block *idom;
+    // innermost loop containing the block, NULL if not in a loop
+    struct __cfg_loop *loop;
+} basic_block;
+
+typedef struct __cfg_loop
+{
+    basic_block *header;
+    struct __cfg_loop *parent;
+    int depth;
+    int block_count;
+    basic_block **blocks;
+} cfg_loop;
+
+typedef struct
+{
+    irlabel *name;
+    // codes [begin, end) of ast.codes, starting at the FUNCTION code
+    int begin, end;
+    int block_count;
+    basic_block **blocks;
+    // reachable blocks in reverse postorder, order[0] is the entry
+    int order_count;
+    basic_block **order;
+    // outermost loops first
+    int loop_count;
+    cfg_loop **loops;
+} cfg_func;
+
+typedef struct
+{
+    ast *tree;
+    int func_count;
+    cfg_func **funcs;
+    // block of each code, NULL for codes outside any block
+    basic_block **block_of;
+} cfg;
+
+cfg *cfg_build(ast *tree);
+
+bool cfg_dominates(basic_block *a, basic_block *b);
+
+int cfg_loop_depth(basic_block *b);
+
+#endif
@@ -16,4 +16,22 @@ void hash(hasher *core, ll value)
     AssertNotNull(core);
     ll r = (core->result * core->seed + value) % MOD;
     core->result = r;
+}
+
+unsigned int hash_string(const char *str)
+{
+    // FNV-1a
+    unsigned int r = 2166136261u;
+    while (*str)
+    {
+        r ^= (unsigned char)*str++;
+        r *= 16777619u;
+    }
+    return r;
+}
+
+unsigned int hash_pointer(const void *ptr)
+{
+    size_t p = (size_t)ptr;
+    return (unsigned int)((p >> 3) ^ (p >> 17)) * 2654435761u;
 }
\ No newline at end of file
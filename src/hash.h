@@ -14,4 +14,8 @@ hasher *new_hasher(ll seed);
 
 void hash(hasher *core, ll value);
 
+unsigned int hash_string(const char *str);
+
+unsigned int hash_pointer(const void *ptr);
+
 #endif
\ No newline at end of file
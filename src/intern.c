@@ -0,0 +1,93 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "intern.h"
+#include "hash.h"
+#include "debug.h"
+
+#define INTERN_POOL_SIZE (64 * 1024)
+
+typedef struct
+{
+    unsigned int hash;
+    const char *str;
+} intern_slot;
+
+static intern_slot *slots = NULL;
+static int slot_count = 0, count = 0;
+
+// Strings are packed into malloc'd pools rather than arenas, since they
+// outlive every compiler phase.
+static char *pool = NULL;
+static size_t pool_left = 0;
+
+static const char *intern_copy(const char *str, size_t len)
+{
+    if (len + 1 > pool_left)
+    {
+        size_t size = len + 1 > INTERN_POOL_SIZE ? len + 1 : INTERN_POOL_SIZE;
+        pool = malloc(size);
+        Assert(pool != NULL, "out of memory");
+        pool_left = size;
+    }
+    char *result = pool;
+    memcpy(result, str, len + 1);
+    pool += len + 1;
+    pool_left -= len + 1;
+    return result;
+}
+
+static void intern_grow()
+{
+    int old_count = slot_count;
+    intern_slot *old = slots;
+    slot_count = slot_count == 0 ? 1024 : slot_count * 2;
+    slots = calloc(slot_count, sizeof(intern_slot));
+    Assert(slots != NULL, "out of memory");
+    int mask = slot_count - 1;
+    for (int i = 0; i < old_count; i++)
+    {
+        if (old[i].str == NULL)
+            continue;
+        int k = old[i].hash & mask;
+        while (slots[k].str != NULL)
+            k = (k + 1) & mask;
+        slots[k] = old[i];
+    }
+    free(old);
+}
+
+const char *intern(const char *str)
+{
+    if ((count + 1) * 2 > slot_count)
+        intern_grow();
+    unsigned int h = hash_string(str);
+    int mask = slot_count - 1;
+    int k = h & mask;
+    while (slots[k].str != NULL)
+    {
+        if (slots[k].hash == h && strcmp(slots[k].str, str) == 0)
+            return slots[k].str;
+        k = (k + 1) & mask;
+    }
+    slots[k].hash = h;
+    slots[k].str = intern_copy(str, strlen(str));
+    count++;
+    return slots[k].str;
+}
+
+const char *internf(const char *format, ...)
+{
+    char buffer[64];
+    va_list aptr;
+    va_start(aptr, format);
+    int len = vsnprintf(buffer, sizeof(buffer), format, aptr);
+    va_end(aptr);
+    Assert(len >= 0 && len < (int)sizeof(buffer), "interned string is too long");
+    return intern(buffer);
+}
+
+int intern_count()
+{
+    return count;
+}
@@ -0,0 +1,14 @@
+#ifndef __INTERN_H__
+#define __INTERN_H__
+
+#include "common.h"
+
+// Returns the unique copy of str, so interned strings are equal iff their
+// pointers are equal. Interned strings live until the process exits.
+const char *intern(const char *str);
+
+const char *internf(const char *format, ...);
+
+int intern_count();
+
+#endif
@@ -10,25 +10,29 @@
 #include "type.h"
 #include "common.h"
 #include "object.h"
+#include "intern.h"
 #include "debug.h"
 #include "semantics.h"
-#include "optimize.h"
 
 void ir_log(int lineno, char *format, ...);
 
-static list *irs = NULL;
+static vector *irs = NULL;
 
 static irvar *ignore_var = NULL;
 
-static list *vars = NULL;
+static vector *vars = NULL;
 
 static int var_count = 0;
 
+// C-- line of the statement being translated, stamped on every code
+static int current_line = 0;
+
 #pragma region helper functions
 
 static void push_ircode(ircode *code)
 {
-    irs = list_pushfront(irs, code);
+    code->lineno = current_line;
+    vector_push(irs, code);
 }
 
 static irvar *new_var()
@@ -37,15 +41,15 @@ static irvar *new_var()
     var_count++;
     irvar *var = new (irvar);
     var->id = var_count;
-    sprintf(var->name, "t%d", var_count);
-    vars = list_pushfront(vars, var);
+    var->name = internf("t%d", var_count);
+    vector_push(vars, var);
     return var;
 }
 
 static irlabel *new_named_label(const char *name)
 {
     irlabel *l = new (irlabel);
-    strcpy(l->name, name);
+    l->name = name;
     return l;
 }
 
@@ -56,7 +60,7 @@ static irlabel *new_label()
     Assert(count >= 0, "too many label");
     count++;
     irlabel *l = new (irlabel);
-    sprintf(l->name, "l%d", count);
+    l->name = internf("l%d", count);
     return l;
 }
 
@@ -228,7 +232,7 @@ static void translate_DecList(syntax_tree *tree);
 static void translate_Dec(syntax_tree *tree);
 static void translate_Exp(syntax_tree *tree, irvar *target);
 static void translate_Cond(syntax_tree *tree, irlabel *true_label, irlabel *false_label);
-static list *translate_Args(syntax_tree *tree);
+static void translate_Args(syntax_tree *tree, vector *args);
 #pragma endregion
 
 static void translate_Program(syntax_tree *tree)
@@ -291,6 +295,7 @@ static void translate_ExtDef(syntax_tree *tree)
 static void translate_FunDec(syntax_tree *tree)
 {
     ir_log(tree->first_line, "%s", "FunDec");
+    current_line = tree->first_line;
     // FunDec : ID LP VarList RP
     //     | ID LP RP
     //     ;
@@ -307,7 +312,7 @@ static void translate_FunDec(syntax_tree *tree)
     env *subev = sem->ev;
     while (i < sym->tp->argc)
     {
-        char *paramname = sym->tp->args[i]->name;
+        const char *paramname = sym->tp->args[i]->name;
         symbol *param = st_findonly(subev->syms, paramname);
         AssertNotNull(param);
         irvar *var = new_var();
@@ -400,6 +405,10 @@ static void translate_Stmt(syntax_tree *tree)
     //     | WHILE LP Exp RP Stmt
     //     ;
     AssertEq(tree->type, ST_Stmt);
+    // Nested statements stamp their own line, the codes after them
+    // (the jump back of a loop, the end label of an if) belong to this one.
+    int outer_line = current_line;
+    current_line = tree->first_line;
     switch (tree->children[0]->type)
     {
     case ST_Exp: // Exp SEMI
@@ -452,6 +461,7 @@ static void translate_Stmt(syntax_tree *tree)
     }
     break;
     }
+    current_line = outer_line;
 }
 static void translate_DefList(syntax_tree *tree)
 {
@@ -495,6 +505,7 @@ static void translate_Dec(syntax_tree *tree)
     //     | VarDec ASSIGNOP Exp
     //     ;
     AssertEq(tree->type, ST_Dec);
+    current_line = tree->first_line;
 
     translate_VarDec(tree->children[0]);
     if (tree->count > 1)
@@ -715,21 +726,8 @@ static void translate_Exp(syntax_tree *tree, irvar *target)
 
                 SES_Exp *leftSem = cast(SES_Exp, tree->children[0]->sem);
                 int sz = 0;
-
-                {
-                    char *name = *cast(sytd_id, tree->children[2]->data);
-                    type *a = leftSem->tp;
-                    AssertEq(a->cls, TC_STRUCT);
-                    for (int i = 0; i < a->memc; i++)
-                    {
-                        symbol *sym = a->mems[i];
-                        if (strcmp(sym->name, name) == 0)
-                        {
-                            break;
-                        }
-                        sz += type_sizeof(sym->tp);
-                    }
-                }
+                symbol *member = type_member(leftSem->tp, *cast(sytd_id, tree->children[2]->data), &sz);
+                AssertNotNull(member);
                 irvar *t1 = new_var();
 
                 gen_add(op_var(t1), op_var(offset), op_const(sz));
@@ -880,19 +878,19 @@ static void translate_Exp(syntax_tree *tree, irvar *target)
         {
             symbol *val = get_symbol_by_id(tree->children[0], tree->ev);
             AssertEq(val->tp->cls, TC_FUNC);
-            list *params = translate_Args(tree->children[2]);
+            vector *params = new_vector();
+            translate_Args(tree->children[2], params);
             if (strcmp(val->name, "write") == 0)
             {
-                irvar *p = cast(irvar, params->obj);
+                irvar *p = cast(irvar, params->data[0]);
                 gen_write(op_rval(p));
                 gen_assign(op_var(target), op_const(0));
             }
             else
             {
-                void **paramArr = list_revto_arr(params);
-                for (int i = 0, j = val->tp->argc - 1; i < val->tp->argc && j >= 0; i++, j--)
+                for (int j = val->tp->argc - 1; j >= 0; j--)
                 {
-                    irvar *p = cast(irvar, paramArr[i]);
+                    irvar *p = cast(irvar, params->data[j]);
                     if (val->tp->args[j]->tp->cls == TC_ARRAY || val->tp->args[j]->tp->cls == TC_STRUCT)
                     {
                         AssertEq(p->isref, true);
@@ -944,7 +942,7 @@ static void translate_Exp(syntax_tree *tree, irvar *target)
         gen_label(f);
     }
 }
-static list *translate_Args(syntax_tree *tree)
+static void translate_Args(syntax_tree *tree, vector *args)
 {
     ir_log(tree->first_line, "%s", "Args");
     // Args : Exp COMMA Args
@@ -954,11 +952,9 @@ static list *translate_Args(syntax_tree *tree)
 
     irvar *var = new_var();
     translate_Exp(tree->children[0], var);
-    list *first = new_list();
-    first->obj = var;
+    vector_push(args, var);
     if (tree->count > 1)
-        first->next = translate_Args(tree->children[2]);
-    return first;
+        translate_Args(tree->children[2], args);
 }
 
 static bool ir_is_passed = false;
@@ -974,7 +970,7 @@ void ir_error(int type, int lineno, char *format, ...)
     int ret;
 
     va_start(aptr, format);
-    vsprintf(ir_buffer, format, aptr);
+    vsnprintf(ir_buffer, sizeof(ir_buffer), format, aptr);
     va_end(aptr);
 
     fprintf(stderr, "%s.\n", ir_buffer);
@@ -988,7 +984,7 @@ void ir_log(int lineno, char *format, ...)
     int ret;
 
     va_start(aptr, format);
-    vsprintf(ir_buffer, format, aptr);
+    vsnprintf(ir_buffer, sizeof(ir_buffer), format, aptr);
     va_end(aptr);
 
 #endif
@@ -999,7 +995,8 @@ void ir_log(int lineno, char *format, ...)
 void ir_prepare()
 {
     ir_is_passed = true;
-    irs = NULL;
+    irs = new_vector();
+    vars = new_vector();
     ignore_var = new_var();
 }
 
@@ -1009,15 +1006,11 @@ ast *ir_translate(syntax_tree *tree)
 
     translate_Program(tree);
 
-    result->len = list_len(irs);
+    result->len = irs->len;
     result->var_count = var_count;
-    result->codes = list_revto_arr(irs);
+    result->codes = irs->data;
     result->vars = vars;
 
-#ifdef OPTIMIZE
-    int count = optimize(result);
-#endif
-
     return result;
 }
 
@@ -1026,137 +1019,143 @@ bool ir_has_passed()
     return ir_is_passed;
 }
 
-static void printOprand(irop *op, FILE *file)
+static void write_oprand(writer *w, irop *op)
 {
     switch (op->kind)
     {
     case IRO_Variable:
-        fprintf(file, "%s", op->var->name);
         break;
     case IRO_Constant:
-        fprintf(file, "#%d", op->value);
-        break;
+        writer_char(w, '#');
+        writer_int(w, op->value);
+        return;
     case IRO_Deref:
-        fprintf(file, "*%s", op->var->name);
+        writer_char(w, '*');
         break;
     case IRO_Ref:
-        fprintf(file, "&%s", op->var->name);
+        writer_char(w, '&');
+        break;
+    }
+    writer_str(w, op->var->name);
+}
+
+static void write_bop(writer *w, ircode *code, const char *op)
+{
+    write_oprand(w, code->bop.target);
+    writer_str(w, " := ");
+    write_oprand(w, code->bop.op1);
+    writer_str(w, op);
+    write_oprand(w, code->bop.op2);
+}
+
+static const char *relop_text(relop_type relop)
+{
+    switch (relop)
+    {
+    case RT_L:
+        return " > ";
+    case RT_S:
+        return " < ";
+    case RT_LE:
+        return " >= ";
+    case RT_SE:
+        return " <= ";
+    case RT_E:
+        return " == ";
+    case RT_NE:
+        return " != ";
+    }
+    return NULL;
+}
+
+void ir_write_code(writer *w, ircode *code)
+{
+    switch (code->kind)
+    {
+    case IR_Label:
+        writer_str(w, "LABEL ");
+        writer_str(w, code->label->name);
+        writer_str(w, " :");
+        break;
+    case IR_Func:
+        writer_str(w, "FUNCTION ");
+        writer_str(w, code->label->name);
+        writer_str(w, " :");
+        break;
+    case IR_Assign:
+        write_oprand(w, code->assign.left);
+        writer_str(w, " := ");
+        write_oprand(w, code->assign.right);
+        break;
+    case IR_Add:
+        write_bop(w, code, " + ");
+        break;
+    case IR_Sub:
+        write_bop(w, code, " - ");
+        break;
+    case IR_Mul:
+        write_bop(w, code, " * ");
+        break;
+    case IR_Div:
+        write_bop(w, code, " / ");
+        break;
+    case IR_Goto:
+        writer_str(w, "GOTO ");
+        writer_str(w, code->label->name);
+        break;
+    case IR_Branch:
+        writer_str(w, "IF ");
+        write_oprand(w, code->branch.op1);
+        writer_str(w, relop_text(code->branch.relop));
+        write_oprand(w, code->branch.op2);
+        writer_str(w, " GOTO ");
+        writer_str(w, code->branch.target->name);
+        break;
+    case IR_Return:
+        writer_str(w, "RETURN ");
+        write_oprand(w, code->ret);
+        break;
+    case IR_Dec:
+        writer_str(w, "DEC ");
+        writer_str(w, code->dec.op->var->name);
+        writer_char(w, ' ');
+        writer_int(w, code->dec.size);
+        break;
+    case IR_Arg:
+        writer_str(w, "ARG ");
+        write_oprand(w, code->arg);
+        break;
+    case IR_Call:
+        writer_str(w, code->call.ret->var->name);
+        writer_str(w, " := CALL ");
+        writer_str(w, code->call.func->name);
+        break;
+    case IR_Param:
+        writer_str(w, "PARAM ");
+        writer_str(w, code->param->var->name);
+        break;
+    case IR_Read:
+        writer_str(w, "READ ");
+        writer_str(w, code->read->var->name);
+        break;
+    case IR_Write:
+        writer_str(w, "WRITE ");
+        write_oprand(w, code->write);
         break;
     }
+    writer_char(w, '\n');
 }
 
 void ir_linearise(ast *tree, FILE *file)
 {
     ir_log(0, "ir.len: %d", tree->len);
+    writer *w = new_writer(file);
     for (int i = 0; i < tree->len; i++)
     {
         ircode *code = cast(ircode, tree->codes[i]);
         if (code->ignore)
             continue;
-        switch (code->kind)
-        {
-        case IR_Label:
-            fprintf(file, "LABEL %s :\n", code->label->name);
-            break;
-        case IR_Func:
-            fprintf(file, "FUNCTION %s :\n", code->label->name);
-            break;
-        case IR_Assign:
-            printOprand(code->assign.left, file);
-            fprintf(file, " := ");
-            printOprand(code->assign.right, file);
-            fprintf(file, "\n");
-            break;
-        case IR_Add:
-            printOprand(code->bop.target, file);
-            fprintf(file, " := ");
-            printOprand(code->bop.op1, file);
-            fprintf(file, " + ");
-            printOprand(code->bop.op2, file);
-            fprintf(file, "\n");
-            break;
-        case IR_Sub:
-            printOprand(code->bop.target, file);
-            fprintf(file, " := ");
-            printOprand(code->bop.op1, file);
-            fprintf(file, " - ");
-            printOprand(code->bop.op2, file);
-            fprintf(file, "\n");
-            break;
-        case IR_Mul:
-            printOprand(code->bop.target, file);
-            fprintf(file, " := ");
-            printOprand(code->bop.op1, file);
-            fprintf(file, " * ");
-            printOprand(code->bop.op2, file);
-            fprintf(file, "\n");
-            break;
-        case IR_Div:
-            printOprand(code->bop.target, file);
-            fprintf(file, " := ");
-            printOprand(code->bop.op1, file);
-            fprintf(file, " / ");
-            printOprand(code->bop.op2, file);
-            fprintf(file, "\n");
-            break;
-        case IR_Goto:
-            fprintf(file, "GOTO %s\n", code->label->name);
-            break;
-        case IR_Branch:
-            fprintf(file, "IF ");
-            printOprand(code->branch.op1, file);
-            switch (code->branch.relop)
-            {
-            case RT_L:
-                fprintf(file, " > ");
-                break;
-            case RT_S:
-                fprintf(file, " < ");
-                break;
-            case RT_LE:
-                fprintf(file, " >= ");
-                break;
-            case RT_SE:
-                fprintf(file, " <= ");
-                break;
-            case RT_E:
-                fprintf(file, " == ");
-                break;
-            case RT_NE:
-                fprintf(file, " != ");
-                break;
-            }
-            printOprand(code->branch.op2, file);
-            fprintf(file, " GOTO %s", code->branch.target->name);
-            fprintf(file, "\n");
-            break;
-        case IR_Return:
-            fprintf(file, "RETURN ");
-            printOprand(code->ret, file);
-            fprintf(file, "\n");
-            break;
-        case IR_Dec:
-            fprintf(file, "DEC %s %d\n", code->dec.op->var->name, code->dec.size);
-            break;
-        case IR_Arg:
-            fprintf(file, "ARG ");
-            printOprand(code->arg, file);
-            fprintf(file, "\n");
-            break;
-        case IR_Call:
-            fprintf(file, "%s := CALL %s\n", code->call.ret->var->name, code->call.func->name);
-            break;
-        case IR_Param:
-            fprintf(file, "PARAM %s\n", code->param->var->name);
-            break;
-        case IR_Read:
-            fprintf(file, "READ %s\n", code->read->var->name);
-            break;
-        case IR_Write:
-            fprintf(file, "WRITE ");
-            printOprand(code->write, file);
-            fprintf(file, "\n");
-            break;
-        }
+        ir_write_code(w, code);
     }
+    writer_flush(w);
 }
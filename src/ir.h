@@ -2,6 +2,7 @@
 #define __IR_H__
 
 #include "ast.h"
+#include "writer.h"
 
 void ir_prepare();
 
@@ -9,6 +10,9 @@ ast* ir_translate(syntax_tree *tree);
 
 void ir_linearise(ast* tree, FILE* file);
 
+// Writes one code as a line of IR text.
+void ir_write_code(writer *w, ircode *code);
+
 bool ir_has_passed();
 
 #endif
\ No newline at end of file
@@ -58,4 +58,29 @@ void **list_revto_arr(list *l)
         i++;
     }
     return result;
+}
+
+vector *new_vector()
+{
+    vector *result = new (vector);
+    result->len = 0;
+    result->capacity = 0;
+    result->data = NULL;
+    return result;
+}
+
+void vector_push(vector *v, void *obj)
+{
+    if (v->len == v->capacity)
+    {
+        int capacity = v->capacity == 0 ? 16 : v->capacity * 2;
+        void **data = newarr(void, capacity);
+        for (int i = 0; i < v->len; i++)
+            data[i] = v->data[i];
+        if (v->data != NULL)
+            delete (v->data);
+        v->data = data;
+        v->capacity = capacity;
+    }
+    v->data[v->len++] = obj;
 }
\ No newline at end of file
@@ -18,4 +18,15 @@ void **list_to_arr(list *l);
 
 void **list_revto_arr(list *l);
 
+typedef struct
+{
+    int len;
+    int capacity;
+    void **data;
+} vector;
+
+vector *new_vector();
+
+void vector_push(vector *v, void *obj);
+
 #endif
\ No newline at end of file
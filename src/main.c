@@ -1,12 +1,16 @@
 #include <stdio.h>
 #include <string.h>
 #include "debug.h"
+#include "object.h"
 #include "ast.h"
 #include "lexical.h"
 #include "syntax.h"
 #include "semantics.h"
+#include "type.h"
 #include "ir.h"
 #include "asm.h"
+#include "optimize.h"
+#include "stats.h"
 
 static FILE *get_input_file(int argc, char **argv)
 {
@@ -62,20 +66,48 @@ static FILE *get_asm_file(int argc, char **argv)
     }
 }
 
+// The mode to stop after, "" for asm. Other flags such as --map= may come
+// before it.
 static char *get_option(int argc, char **argv)
 {
+    static const char *modes[] = {"--lexcial", "--syntax", "--semantics", "--ir"};
     for (int i = 0; i < argc; i++)
     {
-        if (strncmp(argv[i], "--", 2) == 0)
+        for (size_t j = 0; j < sizeof(modes) / sizeof(modes[0]); j++)
         {
-            return argv[i];
+            if (strcmp(argv[i], modes[j]) == 0)
+                return argv[i];
         }
     }
     return "";
 }
 
+static bool has_flag(int argc, char **argv, const char *flag)
+{
+    for (int i = 0; i < argc; i++)
+    {
+        if (strcmp(argv[i], flag) == 0)
+            return true;
+    }
+    return false;
+}
+
+// The file named by --map=, NULL if none was asked for.
+static const char *get_map_name(int argc, char **argv)
+{
+    const char *prefix = "--map=";
+    for (int i = 0; i < argc; i++)
+    {
+        if (strncmp(argv[i], prefix, strlen(prefix)) == 0)
+            return argv[i] + strlen(prefix);
+    }
+    return NULL;
+}
+
 static bool try_lexical(FILE *input)
 {
+    stats_phase("lexical");
+    arena_enter(ARENA_SYNTAX);
     lexical_prepare(input);
     bool result = lexical_test();
     return result;
@@ -83,6 +115,8 @@ static bool try_lexical(FILE *input)
 
 static syntax_tree *try_syntax(FILE *input)
 {
+    stats_phase("syntax");
+    arena_enter(ARENA_SYNTAX);
     lexical_prepare(input);
     syntax_prepare();
     syntax_tree *result = syntax_parse();
@@ -91,19 +125,47 @@ static syntax_tree *try_syntax(FILE *input)
 
 static bool try_semantics(syntax_tree *tree)
 {
+    stats_phase("semantics");
+    arena_enter(ARENA_SEMANTICS);
     semantics_prepare();
     bool result = semantics_analyse(tree);
     return result;
 }
 
+static int live_codes(ast *tree)
+{
+    int count = 0;
+    for (int i = 0; i < tree->len; i++)
+    {
+        if (!cast(ircode, tree->codes[i])->ignore)
+            count++;
+    }
+    return count;
+}
+
 static ast *try_ir(syntax_tree *tree)
 {
+    stats_phase("ir");
+    arena_enter(ARENA_IR);
     ir_prepare();
     ast *at = ir_translate(tree);
+    // The syntax tree and symbol tables are dead once IR is built.
+    arena_release(ARENA_SYNTAX);
+    arena_release(ARENA_SEMANTICS);
+    type_release();
+    if (stats_enabled)
+        stats_ir("translated", live_codes(at));
+
+#ifdef OPTIMIZE
+    stats_phase("optimize");
+    optimize(at);
+    if (stats_enabled)
+        stats_ir("optimized", live_codes(at));
+#endif
     return at;
 }
 
-int main(int argc, char **argv)
+static int run(int argc, char **argv)
 {
     FILE *input = get_input_file(argc, argv);
 
@@ -143,24 +205,64 @@ int main(int argc, char **argv)
 
     if (strcmp(option, "--ir") == 0)
     {
+        stats_phase("output");
         FILE *irfile = get_ir_file(argc, argv);
+        if (irfile == NULL)
+            return 1;
 
         ir_linearise(at, irfile);
 
         if (irfile != stdout)
             fclose(irfile);
 
+        arena_release(ARENA_IR);
         return 0;
     }
 
+    stats_phase("asm");
     FILE *asmfile = get_asm_file(argc, argv);
+    if (asmfile == NULL)
+        return 1;
+
+    // A map that was asked for but cannot be written fails the run.
+    const char *mapname = get_map_name(argc, argv);
+    FILE *mapfile = NULL;
+    if (mapname != NULL && !(mapfile = fopen(mapname, "w")))
+    {
+        perror(mapname);
+        if (asmfile != stdout)
+            fclose(asmfile);
+        return 1;
+    }
+
+    arena_enter(ARENA_ASM);
 
     asm_prepare(asmfile);
 
+    asm_set_comments(!has_flag(argc, argv, "--no-comments"));
+
+    if (mapfile != NULL)
+        asm_set_source_map(mapfile);
+
     asm_generate(at);
 
     if (asmfile != stdout)
         fclose(asmfile);
+    if (mapfile != NULL)
+        fclose(mapfile);
+
+    arena_release(ARENA_ASM);
+    arena_release(ARENA_IR);
 
     return 0;
 }
+
+int main(int argc, char **argv)
+{
+    // --stats prints the time, objects and memory of each phase to stderr.
+    if (has_flag(argc, argv, "--stats"))
+        stats_enable();
+    int exitcode = run(argc, argv);
+    stats_report(stderr);
+    return exitcode;
+}
@@ -0,0 +1,172 @@
+#include <string.h>
+#include "mips.h"
+#include "object.h"
+#include "debug.h"
+
+const char *reg_names[32] = {
+    "$zero", "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3", "$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7",
+    "$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7", "$t8", "$t9", "$k0", "$k1",
+    "$gp", "$sp", "$fp", "$ra"};
+
+static const char *op_names[] = {
+    "", "", "", "lw", "sw", "li", "la", "move",
+    "add", "addi", "sub", "subu", "mul", "div", "slti", "sll", "sra", "srl",
+    "beq", "bne", "bgt", "bge", "blt", "ble",
+    "beqz", "bnez", "bgtz", "bgez", "bltz", "blez",
+    "j", "jal", "jr"};
+
+mips_list *new_mips_list()
+{
+    mips_list *result = new (mips_list);
+    result->len = 0;
+    result->capacity = 0;
+    result->data = NULL;
+    return result;
+}
+
+mips_instr *mips_push(mips_list *l, mips_op op)
+{
+    if (l->len == l->capacity)
+    {
+        int capacity = l->capacity == 0 ? 256 : l->capacity * 2;
+        mips_instr *data = newvalarr(mips_instr, capacity);
+        if (l->data != NULL)
+        {
+            memcpy(data, l->data, sizeof(mips_instr) * l->len);
+            delete (l->data);
+        }
+        l->data = data;
+        l->capacity = capacity;
+    }
+    mips_instr *in = &l->data[l->len++];
+    memset(in, 0, sizeof(mips_instr));
+    in->op = op;
+    return in;
+}
+
+void mips_clear(mips_list *l)
+{
+    l->len = 0;
+}
+
+bool mips_is_branch(mips_op op)
+{
+    return op >= MI_Beq && op <= MI_Blez;
+}
+
+static void write_sep(writer *w)
+{
+    writer_char(w, ',');
+    writer_char(w, ' ');
+}
+
+static void write_reg(writer *w, int r)
+{
+    writer_str(w, reg_names[r]);
+}
+
+void mips_print(mips_instr *in, writer *w)
+{
+    switch (in->op)
+    {
+    case MI_Label:
+        writer_str(w, in->label);
+        writer_str(w, ":\n");
+        return;
+    case MI_Comment:
+        writer_str(w, "# ");
+        writer_str(w, in->text);
+        writer_char(w, '\n');
+        return;
+    case MI_IRComment:
+        panic("IR comment is printed by asm");
+        return;
+    default:
+        break;
+    }
+
+    writer_str(w, "  ");
+    writer_str(w, op_names[in->op]);
+    writer_char(w, ' ');
+    switch (in->op)
+    {
+    case MI_Lw:
+    case MI_Sw:
+        write_reg(w, in->rt);
+        write_sep(w);
+        writer_int(w, in->imm);
+        writer_char(w, '(');
+        write_reg(w, in->rs);
+        writer_char(w, ')');
+        break;
+    case MI_Li:
+        write_reg(w, in->rd);
+        write_sep(w);
+        writer_int(w, in->imm);
+        break;
+    case MI_La:
+        write_reg(w, in->rd);
+        write_sep(w);
+        writer_str(w, in->label);
+        break;
+    case MI_Move:
+        write_reg(w, in->rd);
+        write_sep(w);
+        write_reg(w, in->rs);
+        break;
+    case MI_Add:
+    case MI_Sub:
+    case MI_Subu:
+    case MI_Mul:
+    case MI_Div:
+        write_reg(w, in->rd);
+        write_sep(w);
+        write_reg(w, in->rs);
+        write_sep(w);
+        write_reg(w, in->rt);
+        break;
+    case MI_Addi:
+    case MI_Slti:
+    case MI_Sll:
+    case MI_Sra:
+    case MI_Srl:
+        write_reg(w, in->rd);
+        write_sep(w);
+        write_reg(w, in->rs);
+        write_sep(w);
+        writer_int(w, in->imm);
+        break;
+    case MI_Beq:
+    case MI_Bne:
+    case MI_Bgt:
+    case MI_Bge:
+    case MI_Blt:
+    case MI_Ble:
+        write_reg(w, in->rs);
+        write_sep(w);
+        write_reg(w, in->rt);
+        write_sep(w);
+        writer_str(w, in->label);
+        break;
+    case MI_Beqz:
+    case MI_Bnez:
+    case MI_Bgtz:
+    case MI_Bgez:
+    case MI_Bltz:
+    case MI_Blez:
+        write_reg(w, in->rs);
+        write_sep(w);
+        writer_str(w, in->label);
+        break;
+    case MI_J:
+    case MI_Jal:
+        writer_str(w, in->label);
+        break;
+    case MI_Jr:
+        write_reg(w, in->rs);
+        break;
+    default:
+        break;
+    }
+    writer_char(w, '\n');
+}
@@ -0,0 +1,83 @@
+#ifndef __MIPS_H__
+#define __MIPS_H__
+
+#include <stdio.h>
+#include "common.h"
+#include "writer.h"
+
+typedef enum
+{
+    MI_Label,
+    MI_Comment,
+    MI_IRComment,
+    MI_Lw,
+    MI_Sw,
+    MI_Li,
+    MI_La,
+    MI_Move,
+    MI_Add,
+    MI_Addi,
+    MI_Sub,
+    MI_Subu,
+    MI_Mul,
+    MI_Div,
+    MI_Slti,
+    MI_Sll,
+    MI_Sra,
+    MI_Srl,
+    MI_Beq,
+    MI_Bne,
+    MI_Bgt,
+    MI_Bge,
+    MI_Blt,
+    MI_Ble,
+    MI_Beqz,
+    MI_Bnez,
+    MI_Bgtz,
+    MI_Bgez,
+    MI_Bltz,
+    MI_Blez,
+    MI_J,
+    MI_Jal,
+    MI_Jr,
+} mips_op;
+
+// One instruction, operands as in the assembly text:
+//   lw/sw rt, imm(rs)    li/la rd, imm/label    move rd, rs
+//   op rd, rs, rt        addi/slti/shifts rd, rs, imm
+//   branches rs, rt, label or rs, label    jr rs
+//   IR comments carry the ircode in code and its IR line in imm
+typedef struct
+{
+    mips_op op;
+    bool dead;
+    int rd, rs, rt;
+    int imm;
+    union {
+        const char *label;
+        const char *text;
+        void *code;
+    };
+} mips_instr;
+
+typedef struct
+{
+    int len;
+    int capacity;
+    mips_instr *data;
+} mips_list;
+
+extern const char *reg_names[32];
+
+mips_list *new_mips_list();
+
+mips_instr *mips_push(mips_list *l, mips_op op);
+
+void mips_clear(mips_list *l);
+
+bool mips_is_branch(mips_op op);
+
+// Prints a live instruction other than an IR comment.
+void mips_print(mips_instr *in, writer *w);
+
+#endif
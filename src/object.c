@@ -1,41 +1,301 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "debug.h"
 #include "object.h"
+#include "stats.h"
 
 static const int OBJMAGIC = 21687894;
 
+#define ARENA_ALIGN 16
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+typedef struct __arena_chunk
+{
+    struct __arena_chunk *next;
+    size_t size;
+    size_t used;
+} arena_chunk;
+
+static arena_phase current_arena = ARENA_NONE;
+static arena_chunk *arenas[ARENA_COUNT];
+
+#if OBJECT_PROFILE
+
+// Open addressing on (file, line, type name), a power of two.
+#define PROFILE_SITES 4096
+
 typedef struct
 {
-    int magic;
+    const char *file;
+    int line;
     const char *type_name;
-} objheader;
+    int calls;
+    size_t total;
+    // Arena objects are not deleted one by one, their live bytes are
+    // dropped when the arena is released.
+    size_t live[ARENA_COUNT];
+    size_t peak;
+} alloc_site;
+
+static alloc_site *sites = NULL;
+
+static size_t site_live(alloc_site *site)
+{
+    size_t result = 0;
+    for (int i = 0; i < ARENA_COUNT; i++)
+        result += site->live[i];
+    return result;
+}
+
+static int compare_total(const void *a, const void *b)
+{
+    const alloc_site *x = a, *y = b;
+    if (x->total != y->total)
+        return x->total < y->total ? 1 : -1;
+    return x->line - y->line;
+}
+
+static void profile_report()
+{
+    alloc_site *used = calloc(PROFILE_SITES, sizeof(alloc_site));
+    // per type totals, with all live bytes kept in live[0]; the peak of a
+    // type is the sum of its sites' peaks, an upper bound
+    alloc_site *types = calloc(PROFILE_SITES, sizeof(alloc_site));
+    Assert(used != NULL && types != NULL, "out of memory");
+    int used_len = 0, types_len = 0;
+    for (int i = 0; i < PROFILE_SITES; i++)
+    {
+        if (sites[i].file == NULL)
+            continue;
+        used[used_len++] = sites[i];
+        int j = 0;
+        while (j < types_len && strcmp(types[j].type_name, sites[i].type_name) != 0)
+            j++;
+        if (j == types_len)
+            types[types_len++].type_name = sites[i].type_name;
+        types[j].calls += sites[i].calls;
+        types[j].total += sites[i].total;
+        types[j].live[0] += site_live(&sites[i]);
+        types[j].peak += sites[i].peak;
+    }
+    qsort(used, used_len, sizeof(alloc_site), compare_total);
+    qsort(types, types_len, sizeof(alloc_site), compare_total);
+
+    fprintf(stderr, "%-32s %10s %12s %12s %12s\n", "type", "calls", "total bytes", "peak live", "live bytes");
+    for (int i = 0; i < types_len; i++)
+        fprintf(stderr, "%-32s %10d %12zu %12zu %12zu\n", types[i].type_name, types[i].calls, types[i].total, types[i].peak, types[i].live[0]);
+    fprintf(stderr, "\n%-32s %-20s %10s %12s %12s %12s\n", "call site", "type", "calls", "total bytes", "peak live", "live bytes");
+    for (int i = 0; i < used_len; i++)
+    {
+        char where[256];
+        snprintf(where, sizeof(where), "%s:%d", used[i].file, used[i].line);
+        fprintf(stderr, "%-32s %-20s %10d %12zu %12zu %12zu\n", where, used[i].type_name, used[i].calls, used[i].total, used[i].peak, site_live(&used[i]));
+    }
+    free(used);
+    free(types);
+}
+
+static int site_of(const char *file, int line, const char *type_name)
+{
+    if (sites == NULL)
+    {
+        sites = calloc(PROFILE_SITES, sizeof(alloc_site));
+        Assert(sites != NULL, "out of memory");
+        atexit(profile_report);
+    }
+    unsigned int slot = (((size_t)file >> 3) * 31 + line) & (PROFILE_SITES - 1);
+    for (int i = 0; i < PROFILE_SITES; i++)
+    {
+        alloc_site *site = &sites[slot];
+        if (site->file == NULL)
+        {
+            site->file = file;
+            site->line = line;
+            site->type_name = type_name;
+        }
+        if (site->file == file && site->line == line && site->type_name == type_name)
+            return slot;
+        slot = (slot + 1) & (PROFILE_SITES - 1);
+    }
+    Assert(false, "too many allocation sites");
+    return -1;
+}
+
+#endif
+
+static size_t align_size(size_t size)
+{
+    return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
 
-void *newobj(size_t size, const char *type_name)
+static arena_chunk *new_chunk(size_t size)
+{
+    size_t soc = align_size(sizeof(arena_chunk));
+    // calloc keeps the chunk zeroed, so objects need no memset of their own.
+    arena_chunk *chunk = calloc(1, soc + size);
+    Assert(chunk != NULL, "out of memory");
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+static void *arena_alloc(arena_phase phase, size_t size)
+{
+    size_t soc = align_size(sizeof(arena_chunk));
+    size = align_size(size);
+
+    arena_chunk *head = arenas[phase];
+    if (head != NULL && head->used + size <= head->size)
+    {
+        char *result = (char *)head + soc + head->used;
+        head->used += size;
+        return result;
+    }
+
+    if (size > ARENA_CHUNK_SIZE / 4)
+    {
+        // Big blocks get a chunk of their own, kept behind the head so the
+        // remaining space of the current chunk is not wasted.
+        arena_chunk *chunk = new_chunk(size);
+        chunk->used = size;
+        if (head != NULL)
+        {
+            chunk->next = head->next;
+            head->next = chunk;
+        }
+        else
+            arenas[phase] = chunk;
+        return (char *)chunk + soc;
+    }
+
+    arena_chunk *chunk = new_chunk(ARENA_CHUNK_SIZE);
+    chunk->next = head;
+    chunk->used = size;
+    arenas[phase] = chunk;
+    return (char *)chunk + soc;
+}
+
+arena_phase arena_enter(arena_phase phase)
+{
+    Assert(phase >= ARENA_NONE && phase < ARENA_COUNT, "invalid arena phase %d", phase);
+    arena_phase last = current_arena;
+    current_arena = phase;
+    return last;
+}
+
+void arena_release(arena_phase phase)
+{
+    Assert(phase > ARENA_NONE && phase < ARENA_COUNT, "invalid arena phase %d", phase);
+    arena_chunk *chunk = arenas[phase];
+    while (chunk != NULL)
+    {
+        arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arenas[phase] = NULL;
+#if OBJECT_PROFILE
+    for (int i = 0; sites != NULL && i < PROFILE_SITES; i++)
+        sites[i].live[phase] = 0;
+#endif
+}
+
+size_t arena_size(arena_phase phase)
+{
+    size_t result = 0;
+    for (arena_chunk *chunk = arenas[phase]; chunk != NULL; chunk = chunk->next)
+        result += chunk->used;
+    return result;
+}
+
+void *newobj(size_t size, const char *type_name, int type_id)
 {
     size_t soh = sizeof(objheader);
-    char *result = malloc(soh + size);
-    memset(result, 0, soh + size);
+    char *result;
+    if (current_arena == ARENA_NONE)
+    {
+        result = malloc(soh + size);
+        memset(result, 0, soh + size);
+    }
+    else
+    {
+        result = arena_alloc(current_arena, soh + size);
+    }
+
+    if (stats_enabled)
+        stats_object(type_name, soh + size);
 
     objheader *oh = (objheader *)result;
     oh->magic = OBJMAGIC;
+    oh->arena = current_arena;
+    oh->type_id = type_id;
     oh->type_name = type_name;
+#if OBJECT_PROFILE
+    oh->site = -1;
+    oh->size = soh + size;
+#endif
     return (void *)(result + soh);
 }
 
-void *newobjs(size_t size, int count, const char *type_name)
+void *newobjs(size_t size, int count, const char *type_name, int type_id)
 {
-    return newobj(size * count, type_name);
+    return newobj(size * count, type_name, type_id);
 }
 
+#if OBJECT_PROFILE
+void *newobjat(size_t size, const char *type_name, int type_id, const char *file, int line)
+{
+    void *result = newobj(size, type_name, type_id);
+    objheader *oh = (objheader *)(((char *)result) - sizeof(objheader));
+    oh->site = site_of(file, line, type_name);
+    alloc_site *site = &sites[oh->site];
+    site->calls++;
+    site->total += oh->size;
+    site->live[oh->arena] += oh->size;
+    size_t live = site_live(site);
+    if (live > site->peak)
+        site->peak = live;
+    return result;
+}
+#endif
+
 void deleteobj(void *ptr)
 {
     size_t soh = sizeof(objheader);
     objheader *oh = (objheader *)(((char *)ptr) - soh);
     AssertEq(oh->magic, OBJMAGIC);
+#if OBJECT_PROFILE
+    if (oh->site >= 0 && oh->arena == ARENA_NONE)
+        sites[oh->site].live[ARENA_NONE] -= oh->size;
+#endif
+    // Arena objects live until their whole arena is released.
+    if (oh->arena != ARENA_NONE)
+        return;
     free((void *)oh);
 }
 
+static const char **type_names = NULL;
+static int type_count = 0, type_capacity = 0;
+
+int typeidobj(const char *type_name)
+{
+    // Called once per call site, so a linear scan is enough. Id 0 is left
+    // for objects created without a type id.
+    for (int i = 0; i < type_count; i++)
+        if (strcmp(type_names[i], type_name) == 0)
+            return i + 1;
+    if (type_count == type_capacity)
+    {
+        type_capacity = type_capacity == 0 ? 64 : type_capacity * 2;
+        type_names = realloc(type_names, sizeof(const char *) * type_capacity);
+        Assert(type_names != NULL, "out of memory");
+    }
+    type_names[type_count++] = type_name;
+    Assert(type_count < 65536, "too many object types");
+    return type_count;
+}
+
 const char *typename(void *ptr)
 {
     size_t soh = sizeof(objheader);
@@ -3,17 +3,89 @@
 
 #include "common.h"
 
-#define new(type) ((type*)newobj(sizeof(type), #type))
-#define newarr(type, count) ((type**)newobjs(sizeof(type*), count, #type "*"))
+// Runtime check done by cast/castarr:
+//   2: compare type names with strcmp (default)
+//   1: compare integer type ids, cached per call site
+//   0: no check at all
+#ifndef OBJECT_CHECK
+#define OBJECT_CHECK 2
+#endif
+
+// Allocation profile: 1 records every new/newarr/newvalarr by type name and
+// call site and prints the totals to stderr at exit, 0 (default) records
+// nothing.
+#ifndef OBJECT_PROFILE
+#define OBJECT_PROFILE 0
+#endif
+
+#if OBJECT_CHECK == 1
+#define objtypeid(name) ({ static int __id = 0; if (__id == 0) __id = typeidobj(name); __id; })
+#else
+#define objtypeid(name) 0
+#endif
+
+#if OBJECT_PROFILE
+#define new(type) ((type*)newobjat(sizeof(type), #type, objtypeid(#type), __FILE__, __LINE__))
+#define newarr(type, count) ((type**)newobjat(sizeof(type*) * (count), #type "*", objtypeid(#type "*"), __FILE__, __LINE__))
+#define newvalarr(type, count) ((type*)newobjat(sizeof(type) * (count), #type "[]", objtypeid(#type "[]"), __FILE__, __LINE__))
+#else
+#define new(type) ((type*)newobj(sizeof(type), #type, objtypeid(#type)))
+#define newarr(type, count) ((type**)newobjs(sizeof(type*), count, #type "*", objtypeid(#type "*")))
+#define newvalarr(type, count) ((type*)newobjs(sizeof(type), count, #type "[]", objtypeid(#type "[]")))
+#endif
 #define delete(ptr) (deleteobj(ptr))
 #define instanceof(type, ptr) (instanceofobj(ptr, #type))
 #define instancearrof(type, ptr) (instanceofobj(ptr, #type "*"))
+
+#if OBJECT_CHECK == 2
 #define cast(type, ptr) ((type*)castobj(ptr, #type, __FILE__, __LINE__))
 #define castarr(type, ptr) ((type**)castobj(ptr, #type "*", __FILE__, __LINE__))
+#elif OBJECT_CHECK == 1
+#define cast(type, ptr) ((type*)castobjid(ptr, objtypeid(#type), #type, __FILE__, __LINE__))
+#define castarr(type, ptr) ((type**)castobjid(ptr, objtypeid(#type "*"), #type "*", __FILE__, __LINE__))
+#else
+#define cast(type, ptr) ((type*)(ptr))
+#define castarr(type, ptr) ((type**)(ptr))
+#endif
+
+typedef struct
+{
+    int magic;
+    unsigned short arena;
+    unsigned short type_id;
+    const char *type_name;
+#if OBJECT_PROFILE
+    int site;
+    unsigned int size;
+#endif
+} objheader;
+
+typedef enum
+{
+    ARENA_NONE,
+    ARENA_SYNTAX,
+    ARENA_SEMANTICS,
+    ARENA_IR,
+    ARENA_ASM,
+    ARENA_COUNT
+} arena_phase;
 
-void *newobj(size_t size, const char *type_name);
+// Objects created while a phase is entered are bump-allocated from that
+// phase's arena and reclaimed together by arena_release. ARENA_NONE (the
+// default) falls back to malloc/free per object.
+arena_phase arena_enter(arena_phase phase);
 
-void *newobjs(size_t size, int count, const char *type_name);
+void arena_release(arena_phase phase);
+
+size_t arena_size(arena_phase phase);
+
+void *newobj(size_t size, const char *type_name, int type_id);
+
+void *newobjs(size_t size, int count, const char *type_name, int type_id);
+
+#if OBJECT_PROFILE
+void *newobjat(size_t size, const char *type_name, int type_id, const char *file, int line);
+#endif
 
 void deleteobj(void *ptr);
 
@@ -23,4 +95,14 @@ void *castobj(void *ptr, const char *type_name, const char *file, int line);
 
 const char* typename(void *ptr);
 
+int typeidobj(const char *type_name);
+
+static inline void *castobjid(void *ptr, int type_id, const char *type_name, const char *file, int line)
+{
+    objheader *oh = (objheader *)(((char *)ptr) - sizeof(objheader));
+    if (oh->type_id != type_id)
+        return castobj(ptr, type_name, file, line);
+    return ptr;
+}
+
 #endif
\ No newline at end of file
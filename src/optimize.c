@@ -1,423 +1,535 @@
 #include <string.h>
 #include "optimize.h"
+#include "cfg.h"
 #include "object.h"
 #include "debug.h"
 
-static void optimizeDupLabel(ast *tree)
+// Each rule below looks at a single code and reports whether it changed
+// anything. The driver keeps a worklist of codes and only revisits the
+// codes whose operands, use counts or neighbours changed, until nothing
+// is left to do.
+
+typedef struct __code_ref
+{
+    int index;
+    struct __code_ref *next;
+} code_ref;
+
+static ast *opt_tree = NULL;
+
+// codes using / assigning each var, indexed by irvar id
+static code_ref **uses = NULL;
+static code_ref **defs = NULL;
+
+// label objects renamed into the label code at each index
+static vector **merged = NULL;
+
+static int *worklist = NULL;
+static int work_head = 0, work_tail = 0;
+static bool *queued = NULL;
+
+#pragma region worklist
+
+static ircode *code_at(int index)
+{
+    return cast(ircode, opt_tree->codes[index]);
+}
+
+static void push_code(int index)
+{
+    if (queued[index] || code_at(index)->ignore)
+        return;
+    queued[index] = true;
+    worklist[work_tail] = index;
+    work_tail = (work_tail + 1) % (opt_tree->len + 1);
+}
+
+static int pop_code()
+{
+    if (work_head == work_tail)
+        return -1;
+    int index = worklist[work_head];
+    work_head = (work_head + 1) % (opt_tree->len + 1);
+    queued[index] = false;
+    return index;
+}
+
+static void add_ref(code_ref **refs, irvar *var, int index)
+{
+    code_ref *ref = new (code_ref);
+    ref->index = index;
+    ref->next = refs[var->id];
+    refs[var->id] = ref;
+}
+
+static void push_defs(irvar *var)
+{
+    for (code_ref *ref = defs[var->id]; ref != NULL; ref = ref->next)
+        push_code(ref->index);
+}
+
+#pragma endregion
+
+#pragma region use counts
+
+static void count_use(irop *op, int index, int delta)
+{
+    if (op->kind == IRO_Constant)
+        return;
+    irvar *var = op->var;
+    var->usedTime += delta;
+    if (delta > 0)
+        add_ref(uses, var, index);
+    else if (var->usedTime <= 1)
+        push_defs(var); // may be dead or single-use now
+}
+
+static void count_assign(irvar *var, int index, int delta)
+{
+    var->assignTime += delta;
+    if (delta > 0)
+        add_ref(defs, var, index);
+    else if (var->assignTime <= 1)
+        push_defs(var);
+}
+
+// Applies (delta = 1) or takes back (delta = -1) the uses and assigns
+// of a code. Only Assign, Dec, Call and Read count as assigns; the
+// target of an arithmetic code is only recorded as a def.
+static void count_code(int index, int delta)
 {
-    for (int i = 0; i < tree->len;)
+    ircode *code = code_at(index);
+    switch (code->kind)
     {
-        ircode *code = cast(ircode, tree->codes[i]);
-        if (code->ignore)
-        {
-            i++;
-            continue;
-        }
-        switch (code->kind)
-        {
-        case IR_Label:
-        {
-            int j = i + 1;
-            for (; j < tree->len; j++)
-            {
-                ircode *tc = cast(ircode, tree->codes[j]);
-                if (tc->ignore)
-                    continue;
-                if (tc->kind != IR_Label)
-                    break;
-                strcpy(tc->label->name, code->label->name);
-                tc->ignore = true;
-            }
-            i = j;
-        }
+    case IR_Assign:
+        count_assign(code->assign.left->var, index, delta);
+        if (code->assign.left->kind == IRO_Deref)
+            count_use(code->assign.left, index, delta);
+        count_use(code->assign.right, index, delta);
+        break;
+    case IR_Add:
+    case IR_Sub:
+    case IR_Mul:
+    case IR_Div:
+        if (delta > 0)
+            add_ref(defs, code->bop.target->var, index);
+        count_use(code->bop.op1, index, delta);
+        count_use(code->bop.op2, index, delta);
+        break;
+    case IR_Branch:
+        count_use(code->branch.op1, index, delta);
+        count_use(code->branch.op2, index, delta);
+        break;
+    case IR_Return:
+        count_use(code->ret, index, delta);
+        break;
+    case IR_Dec:
+        count_assign(code->dec.op->var, index, delta);
+        break;
+    case IR_Arg:
+        count_use(code->arg, index, delta);
+        break;
+    case IR_Call:
+        count_assign(code->call.ret->var, index, delta);
+        break;
+    case IR_Read:
+        count_assign(code->read->var, index, delta);
+        break;
+    case IR_Write:
+        count_use(code->write, index, delta);
+        break;
+    default:
         break;
-        default:
-            i++;
-            break;
-        }
     }
 }
 
-static void optimizeDupVar(ast *tree)
+static bool op_uses(irop *op, irvar *var)
 {
-    for (int i = 0; i < tree->len; i++)
+    return op->kind != IRO_Constant && op->var == var;
+}
+
+static bool code_uses(ircode *code, irvar *var)
+{
+    switch (code->kind)
     {
-        ircode *code = cast(ircode, tree->codes[i]);
-        if (code->ignore)
-            continue;
-        if (code->kind == IR_Assign)
+    case IR_Assign:
+        return (code->assign.left->kind == IRO_Deref && op_uses(code->assign.left, var)) ||
+               op_uses(code->assign.right, var);
+    case IR_Add:
+    case IR_Sub:
+    case IR_Mul:
+    case IR_Div:
+        return op_uses(code->bop.op1, var) || op_uses(code->bop.op2, var);
+    case IR_Branch:
+        return op_uses(code->branch.op1, var) || op_uses(code->branch.op2, var);
+    case IR_Return:
+        return op_uses(code->ret, var);
+    case IR_Arg:
+        return op_uses(code->arg, var);
+    case IR_Write:
+        return op_uses(code->write, var);
+    default:
+        return false;
+    }
+}
+
+// index of the only code still using var
+static int single_use(irvar *var)
+{
+    for (code_ref *ref = uses[var->id]; ref != NULL; ref = ref->next)
+    {
+        ircode *code = code_at(ref->index);
+        if (!code->ignore && code_uses(code, var))
         {
-            if (code->assign.left->kind == IRO_Variable && code->assign.right->kind != IRO_Deref)
-            {
-                irvar *var = code->assign.left->var;
-                irop *value = code->assign.right;
-                if (var->usedTime == 1 && var->assignTime == 1)
-                {
-                    ircode *use = cast(ircode, var->usedCode);
-                    if (use->ignore)
-                        continue;
-                    switch (use->kind)
-                    {
-                    case IR_Assign:
-                        if (use->assign.right->kind == IRO_Variable && use->assign.right->var == var)
-                        {
-                            use->assign.right = value;
-                            code->ignore = true;
-                        }
-                        break;
-                    case IR_Add:
-                    case IR_Sub:
-                    case IR_Mul:
-                    case IR_Div:
-                        if (use->bop.op1->kind == IRO_Variable && use->bop.op1->var == var)
-                        {
-                            use->bop.op1 = value;
-                            code->ignore = true;
-                        }
-                        else if (use->bop.op2->kind == IRO_Variable && use->bop.op2->var == var)
-                        {
-                            use->bop.op2 = value;
-                            code->ignore = true;
-                        }
-                        break;
-                    case IR_Branch:
-                        if (use->branch.op1->kind == IRO_Variable && use->branch.op1->var == var)
-                        {
-                            use->branch.op1 = value;
-                            code->ignore = true;
-                        }
-                        else if (use->branch.op2->kind == IRO_Variable && use->branch.op2->var == var)
-                        {
-                            use->bop.op2 = value;
-                            code->ignore = true;
-                        }
-                        break;
-                    case IR_Return:
-                        if (use->ret->kind == IRO_Variable && use->ret->var == var)
-                        {
-                            use->ret = value;
-                            code->ignore = true;
-                        }
-                        break;
-                    case IR_Arg:
-                        if (use->arg->kind == IRO_Variable && use->arg->var == var)
-                        {
-                            use->arg = value;
-                            code->ignore = true;
-                        }
-                        break;
-                    case IR_Read:
-                        break;
-                    case IR_Write:
-                        if (use->write->kind == IRO_Variable && use->write->var == var)
-                        {
-                            use->write = value;
-                            code->ignore = true;
-                        }
-                        break;
-                    }
-                }
-            }
+            var->usedCode = code;
+            return ref->index;
         }
     }
+    panic("use of %s not found", var->name);
 }
 
-static void optimizeDupGoto(ast *tree)
+static void kill_code(int index)
 {
-    for (int i = 0; i < tree->len; i++)
+    ircode *code = code_at(index);
+    AssertEq(code->ignore, false);
+    code->ignore = true;
+    count_code(index, -1);
+
+    // A goto or label run right before this code may now be adjacent to
+    // the labels after it.
+    for (int i = index - 1; i >= 0; i--)
     {
-        ircode *code = cast(ircode, tree->codes[i]);
-        if (code->ignore)
-        {
+        ircode *prev = code_at(i);
+        if (prev->ignore)
             continue;
-        }
-        switch (code->kind)
+        push_code(i);
+        if (prev->kind != IR_Label)
+            break;
+    }
+}
+
+#pragma endregion
+
+#pragma region rules
+
+static bool optimizeDupLabel(int index)
+{
+    ircode *code = code_at(index);
+    if (code->kind != IR_Label)
+        return false;
+
+    // Only the first label of a run absorbs the others.
+    for (int i = index - 1; i >= 0; i--)
+    {
+        ircode *prev = code_at(i);
+        if (prev->ignore)
+            continue;
+        if (prev->kind == IR_Label)
         {
-        case IR_Goto:
+            push_code(i);
+            return false;
+        }
+        break;
+    }
+
+    bool changed = false;
+    for (int j = index + 1; j < opt_tree->len; j++)
+    {
+        ircode *tc = code_at(j);
+        if (tc->ignore)
+            continue;
+        if (tc->kind != IR_Label)
+            break;
+        if (merged[index] == NULL)
+            merged[index] = new_vector();
+        // Labels merged into tc earlier follow it into this run.
+        if (merged[j] != NULL)
         {
-            bool isdup = false;
-            for (int j = i + 1; j < tree->len; j++)
+            for (int k = 0; k < merged[j]->len; k++)
             {
-                ircode *tc = cast(ircode, tree->codes[j]);
-                if (tc->ignore)
-                    continue;
-                if (tc->kind != IR_Label)
-                    break;
-                if (strcmp(tc->label->name, code->label->name) == 0)
-                {
-                    isdup = true;
-                    break;
-                }
+                irlabel *l = cast(irlabel, merged[j]->data[k]);
+                l->name = code->label->name;
+                vector_push(merged[index], l);
             }
-            if (isdup)
-                code->ignore = true;
         }
+        tc->label->name = code->label->name;
+        vector_push(merged[index], tc->label);
+        kill_code(j);
+        changed = true;
+    }
+    return changed;
+}
+
+static bool optimizeDupVar(int index)
+{
+    ircode *code = code_at(index);
+    if (code->kind != IR_Assign)
+        return false;
+    if (code->assign.left->kind != IRO_Variable || code->assign.right->kind == IRO_Deref)
+        return false;
+    irvar *var = code->assign.left->var;
+    irop *value = code->assign.right;
+    if (var->usedTime != 1 || var->assignTime != 1)
+        return false;
+
+    int use_index = single_use(var);
+    ircode *use = code_at(use_index);
+    irop *var_op = op_var(var);
+    irop **slot = NULL;
+    switch (use->kind)
+    {
+    case IR_Assign:
+        if (use->assign.right == var_op)
+            slot = &use->assign.right;
+        break;
+    case IR_Add:
+    case IR_Sub:
+    case IR_Mul:
+    case IR_Div:
+        if (use->bop.op1 == var_op)
+            slot = &use->bop.op1;
+        else if (use->bop.op2 == var_op)
+            slot = &use->bop.op2;
+        break;
+    case IR_Branch:
+        if (use->branch.op1 == var_op)
+            slot = &use->branch.op1;
+        else if (use->branch.op2 == var_op)
+            slot = &use->branch.op2;
+        break;
+    case IR_Return:
+        if (use->ret == var_op)
+            slot = &use->ret;
+        break;
+    case IR_Arg:
+        if (use->arg == var_op)
+            slot = &use->arg;
+        break;
+    case IR_Write:
+        if (use->write == var_op)
+            slot = &use->write;
         break;
+    default:
+        break;
+    }
+    if (slot == NULL)
+        return false;
+
+    *slot = value;
+    var->usedTime--;
+    if (value->kind != IRO_Constant)
+    {
+        value->var->usedTime++;
+        add_ref(uses, value->var, use_index);
+    }
+    kill_code(index);
+    push_code(use_index);
+    return true;
+}
+
+static bool optimizeDupGoto(int index)
+{
+    ircode *code = code_at(index);
+    if (code->kind != IR_Goto)
+        return false;
+    for (int j = index + 1; j < opt_tree->len; j++)
+    {
+        ircode *tc = code_at(j);
+        if (tc->ignore)
+            continue;
+        if (tc->kind != IR_Label)
+            break;
+        if (tc->label->name == code->label->name)
+        {
+            kill_code(index);
+            return true;
         }
     }
+    return false;
 }
 
-static void optimizeDeadAssign(ast *tree)
+static bool optimizeDeadAssign(int index)
 {
-    for (list *l = tree->vars; l != NULL; l = l->next)
+    ircode *code = code_at(index);
+    irvar *target = NULL;
+    switch (code->kind)
     {
-        irvar *var = cast(irvar, l->obj);
-        var->assignTime = 0;
-        var->usedCode = NULL;
-        var->usedTime = 0;
+    case IR_Assign:
+        target = code->assign.left->var;
+        break;
+    case IR_Add:
+    case IR_Sub:
+    case IR_Mul:
+    case IR_Div:
+        target = code->bop.target->var;
+        break;
+    case IR_Dec:
+        target = code->dec.op->var;
+        break;
+    default:
+        return false;
     }
-    for (int i = 0; i < tree->len; i++)
+    if (target->usedTime != 0)
+        return false;
+    kill_code(index);
+    return true;
+}
+
+static bool optimizeConstExp(int index)
+{
+    ircode *code = code_at(index);
+    switch (code->kind)
     {
-        ircode *code = cast(ircode, tree->codes[i]);
-        if (code->ignore)
-            continue;
+    case IR_Add:
+    case IR_Sub:
+    case IR_Mul:
+    case IR_Div:
+    {
+        if (code->bop.op1->kind != IRO_Constant || code->bop.op2->kind != IRO_Constant)
+            return false;
+        int a = code->bop.op1->value, b = code->bop.op2->value;
+        int result = 0;
         switch (code->kind)
         {
-        case IR_Label:
-            break;
-        case IR_Func:
-            break;
-        case IR_Assign:
-            code->assign.left->var->assignTime++;
-            if (code->assign.left->kind == IRO_Deref)
-            {
-                code->assign.left->var->usedTime++;
-                code->assign.left->var->usedCode = code;
-            }
-            if (code->assign.right->kind != IRO_Constant)
-            {
-                code->assign.right->var->usedTime++;
-                code->assign.right->var->usedCode = code;
-            }
-            break;
         case IR_Add:
-        case IR_Sub:
-        case IR_Mul:
-        case IR_Div:
-            if (code->bop.op1->kind != IRO_Constant)
-            {
-                code->bop.op1->var->usedTime++;
-                code->bop.op1->var->usedCode = code;
-            }
-            if (code->bop.op2->kind != IRO_Constant)
-            {
-                code->bop.op2->var->usedTime++;
-                code->bop.op2->var->usedCode = code;
-            }
-            break;
-        case IR_Branch:
-            if (code->branch.op1->kind != IRO_Constant)
-            {
-                code->branch.op1->var->usedTime++;
-                code->branch.op1->var->usedCode = code;
-            }
-            if (code->branch.op2->kind != IRO_Constant)
-            {
-                code->branch.op2->var->usedTime++;
-                code->branch.op2->var->usedCode = code;
-            }
-            break;
-        case IR_Return:
-            if (code->ret->kind != IRO_Constant)
-            {
-                code->ret->var->usedTime++;
-                code->ret->var->usedCode = code;
-            }
+            result = a + b;
             break;
-        case IR_Dec:
-            code->dec.op->var->assignTime++;
-            break;
-        case IR_Arg:
-            if (code->arg->kind != IRO_Constant)
-            {
-                code->arg->var->usedTime++;
-                code->arg->var->usedCode = code;
-            }
-            break;
-        case IR_Call:
-            code->call.ret->var->assignTime++;
-            break;
-        case IR_Param:
+        case IR_Sub:
+            result = a - b;
             break;
-        case IR_Read:
-            code->read->var->assignTime++;
+        case IR_Mul:
+            result = a * b;
             break;
-        case IR_Write:
-            if (code->write->kind != IRO_Constant)
-            {
-                code->write->var->usedTime++;
-                code->write->var->usedCode = code;
-            }
+        case IR_Div:
+            // UB div 0
+            result = b != 0 ? a / b : 0;
             break;
         }
+        irop *target = code->bop.target;
+        code->kind = IR_Assign;
+        code->assign.left = target;
+        code->assign.right = op_const(result);
+        // the target now counts as assigned
+        count_assign(target->var, index, 1);
+        return true;
     }
-    for (int i = 0; i < tree->len; i++)
+    case IR_Branch:
     {
-        ircode *code = cast(ircode, tree->codes[i]);
-        switch (code->kind)
+        if (code->branch.op1->kind != IRO_Constant || code->branch.op2->kind != IRO_Constant)
+            return false;
+        int a = code->branch.op1->value, b = code->branch.op2->value;
+        bool result = false;
+        switch (code->branch.relop)
         {
-        case IR_Label:
+        case RT_L:
+            result = a > b;
             break;
-        case IR_Func:
+        case RT_S:
+            result = a < b;
             break;
-        case IR_Assign:
-            if (code->assign.left->var->usedTime == 0)
-            {
-                code->ignore = true;
-            }
-            break;
-        case IR_Add:
-        case IR_Sub:
-        case IR_Mul:
-        case IR_Div:
-            if (code->bop.target->var->usedTime == 0)
-            {
-                code->ignore = true;
-            }
-            break;
-        case IR_Branch:
-            break;
-        case IR_Return:
-            break;
-        case IR_Dec:
-            if (code->dec.op->var->usedTime == 0)
-            {
-                code->ignore = true;
-            }
-            break;
-        case IR_Arg:
+        case RT_LE:
+            result = a >= b;
             break;
-        case IR_Call:
+        case RT_SE:
+            result = a <= b;
             break;
-        case IR_Param:
+        case RT_E:
+            result = a == b;
             break;
-        case IR_Read:
-            break;
-        case IR_Write:
+        case RT_NE:
+            result = a != b;
             break;
         }
+        if (!result)
+            return false;
+        code->kind = IR_Goto;
+        code->label = code->branch.target;
+        return true;
+    }
+    default:
+        return false;
     }
 }
 
-static void optimizeConstExp(ast *tree)
+// Removing blocks can make more codes dead, so this runs whenever the
+// worklist is drained and refills it.
+static bool optimizeUnreachable()
 {
-    for (int i = 0; i < tree->len; i++)
+    cfg *g = cfg_build(opt_tree);
+    bool changed = false;
+    for (int i = 0; i < g->func_count; i++)
     {
-        ircode *code = cast(ircode, tree->codes[i]);
-        switch (code->kind)
+        cfg_func *func = g->funcs[i];
+        for (int j = 0; j < func->block_count; j++)
         {
-        case IR_Add:
-            if (code->bop.op1->kind == IRO_Constant && code->bop.op2->kind == IRO_Constant)
+            basic_block *b = func->blocks[j];
+            if (b->rpo >= 0)
+                continue;
+            for (int k = b->begin; k < b->end; k++)
             {
-                int result = code->bop.op1->value + code->bop.op2->value;
-                code->kind = IR_Assign;
-                code->assign.left = code->bop.target;
-                code->assign.right = op_const(result);
-            }
-        case IR_Sub:
-            if (code->bop.op1->kind == IRO_Constant && code->bop.op2->kind == IRO_Constant)
-            {
-                int result = code->bop.op1->value - code->bop.op2->value;
-                code->kind = IR_Assign;
-                code->assign.left = code->bop.target;
-                code->assign.right = op_const(result);
-            }
-        case IR_Mul:
-            if (code->bop.op1->kind == IRO_Constant && code->bop.op2->kind == IRO_Constant)
-            {
-                int result = code->bop.op1->value * code->bop.op2->value;
-                code->kind = IR_Assign;
-                code->assign.left = code->bop.target;
-                code->assign.right = op_const(result);
-            }
-        case IR_Div:
-            if (code->bop.op1->kind == IRO_Constant && code->bop.op2->kind == IRO_Constant)
-            {
-                if (code->bop.op2->value != 0)
-                {
-                    int result = code->bop.op1->value / code->bop.op2->value;
-                    code->kind = IR_Assign;
-                    code->assign.left = code->bop.target;
-                    code->assign.right = op_const(result);
-                }
-                else
-                {
-                    // UB div 0
-                    code->kind = IR_Assign;
-                    code->assign.left = code->bop.target;
-                    code->assign.right = op_const(0);
-                }
-            }
-            break;
-        case IR_Branch:
-            if (code->branch.op1->kind == IRO_Constant && code->branch.op2->kind == IRO_Constant)
-            {
-                bool result = false;
-                switch (code->branch.relop)
-                {
-                case RT_L:
-                    result = code->branch.op1->value > code->branch.op2->value;
-                    break;
-                case RT_S:
-                    result = code->branch.op1->value < code->branch.op2->value;
-                    break;
-                case RT_LE:
-                    result = code->branch.op1->value >= code->branch.op2->value;
-                    break;
-                case RT_SE:
-                    result = code->branch.op1->value <= code->branch.op2->value;
-                    break;
-                case RT_E:
-                    result = code->branch.op1->value == code->branch.op2->value;
-                    break;
-                case RT_NE:
-                    result = code->branch.op1->value != code->branch.op2->value;
-                    break;
-                }
-                if (result)
-                {
-                    code->kind = IR_Goto;
-                    code->label = code->branch.target;
-                }
+                ircode *code = code_at(k);
+                // irsim allocates arrays at their DEC, keep it
+                if (code->ignore || code->kind == IR_Dec)
+                    continue;
+                kill_code(k);
+                changed = true;
             }
-            break;
-        case IR_Return:
-            break;
-        case IR_Dec:
-            break;
-        case IR_Arg:
-            break;
-        case IR_Call:
-            break;
-        case IR_Param:
-            break;
-        case IR_Read:
-            break;
-        case IR_Write:
-            break;
         }
     }
+    return changed;
 }
 
+#pragma endregion
+
 int optimize(ast *tree)
 {
-    const int T = 100;
+    opt_tree = tree;
+    int var_slots = tree->var_count + 1;
+    uses = newarr(code_ref, var_slots);
+    defs = newarr(code_ref, var_slots);
+    merged = newarr(vector, tree->len);
+    worklist = newvalarr(int, tree->len + 1);
+    queued = newvalarr(bool, tree->len);
+    work_head = work_tail = 0;
 
-    for (int i = 0; i < T; i++)
+    for (int i = 0; i < tree->vars->len; i++)
+    {
+        irvar *var = cast(irvar, tree->vars->data[i]);
+        var->assignTime = 0;
+        var->usedCode = NULL;
+        var->usedTime = 0;
+    }
+    for (int i = 0; i < tree->len; i++)
     {
-        optimizeDeadAssign(tree);
-        optimizeDupLabel(tree);
-        optimizeDupVar(tree);
-        optimizeConstExp(tree);
-        optimizeDupGoto(tree);
+        if (!code_at(i)->ignore)
+            count_code(i, 1);
     }
+    for (int i = 0; i < tree->len; i++)
+        push_code(i);
+
+    do
+    {
+        for (int index = pop_code(); index >= 0; index = pop_code())
+        {
+            if (code_at(index)->ignore)
+                continue;
+            bool changed = optimizeDeadAssign(index) ||
+                           optimizeDupLabel(index) ||
+                           optimizeDupVar(index) ||
+                           optimizeConstExp(index) ||
+                           optimizeDupGoto(index);
+            // let the other rules look at a code that was rewritten
+            if (changed)
+                push_code(index);
+        }
+    } while (optimizeUnreachable());
 
     int count = 0;
     for (int i = 0; i < tree->len; i++)
     {
-        ircode *code = cast(ircode, tree->codes[i]);
+        ircode *code = code_at(i);
         if (code->ignore)
             count++;
     }
     return count;
-}
\ No newline at end of file
+}
@@ -0,0 +1,225 @@
+#include "peephole.h"
+#include "debug.h"
+
+// A sliding window over the live instructions. Comments are skipped, and
+// labels end the window except for the jump rules.
+
+const char *peephole_names[PH_COUNT] = {
+    "move to itself",
+    "load after store",
+    "push then pop",
+    "addi merge",
+    "jump to next",
+    "branch over jump",
+    "unreachable",
+};
+
+int peephole_removed[PH_COUNT];
+
+static mips_list *list = NULL;
+
+static bool is_comment(mips_instr *in)
+{
+    return in->op == MI_Comment || in->op == MI_IRComment;
+}
+
+// Index of the next live instruction after i, list->len if none.
+static int next(int i)
+{
+    for (i++; i < list->len; i++)
+    {
+        mips_instr *in = &list->data[i];
+        if (!in->dead && !is_comment(in))
+            break;
+    }
+    return i;
+}
+
+static mips_instr *at(int i)
+{
+    return i < list->len ? &list->data[i] : NULL;
+}
+
+static void kill(mips_instr *in, peephole_rule rule)
+{
+    in->dead = true;
+    peephole_removed[rule]++;
+}
+
+static bool is_sp_adjust(mips_instr *in, int imm)
+{
+    return in != NULL && in->op == MI_Addi && in->rd == 29 && in->rs == 29 && in->imm == imm;
+}
+
+static bool same_slot(mips_instr *store, mips_instr *load)
+{
+    return load != NULL && load->op == MI_Lw && load->rs == store->rs && load->imm == store->imm;
+}
+
+static void to_move(mips_instr *in, int rd, int rs)
+{
+    in->op = MI_Move;
+    in->rd = rd;
+    in->rs = rs;
+}
+
+static mips_op invert(mips_op op)
+{
+    switch (op)
+    {
+    case MI_Beq:
+        return MI_Bne;
+    case MI_Bne:
+        return MI_Beq;
+    case MI_Bgt:
+        return MI_Ble;
+    case MI_Ble:
+        return MI_Bgt;
+    case MI_Bge:
+        return MI_Blt;
+    case MI_Blt:
+        return MI_Bge;
+    case MI_Beqz:
+        return MI_Bnez;
+    case MI_Bnez:
+        return MI_Beqz;
+    case MI_Bgtz:
+        return MI_Blez;
+    case MI_Blez:
+        return MI_Bgtz;
+    case MI_Bgez:
+        return MI_Bltz;
+    case MI_Bltz:
+        return MI_Bgez;
+    default:
+        panic("Not a branch");
+        return op;
+    }
+}
+
+// True if one of the labels starting at index i is name.
+static bool labels_have(int i, const char *name)
+{
+    for (; i < list->len; i++)
+    {
+        mips_instr *in = &list->data[i];
+        if (in->dead || is_comment(in))
+            continue;
+        if (in->op != MI_Label)
+            return false;
+        // labels are interned
+        if (in->label == name)
+            return true;
+    }
+    return false;
+}
+
+static bool rule_at(int i)
+{
+    mips_instr *in = &list->data[i];
+    int j = next(i);
+    mips_instr *nx = at(j);
+
+    switch (in->op)
+    {
+    case MI_Move:
+        if (in->rd == in->rs)
+        {
+            kill(in, PH_SelfMove);
+            return true;
+        }
+        break;
+    case MI_Addi:
+    {
+        // addi $sp, $sp, -4; sw r, 0($sp); lw r2, 0($sp); addi $sp, $sp, 4
+        if (is_sp_adjust(in, -4) && nx != NULL && nx->op == MI_Sw && nx->rs == 29 && nx->imm == 0)
+        {
+            int k = next(j), l = next(k);
+            mips_instr *load = at(k), *pop = at(l);
+            if (same_slot(nx, load) && is_sp_adjust(pop, 4))
+            {
+                int rd = load->rt, rs = nx->rt;
+                kill(in, PH_PushPop);
+                kill(nx, PH_PushPop);
+                kill(pop, PH_PushPop);
+                if (rd == rs)
+                    kill(load, PH_PushPop);
+                else
+                    to_move(load, rd, rs);
+                return true;
+            }
+        }
+        // addi r, r, a; addi r, r, b while a + b still fits the immediate
+        long long sum = nx != NULL ? (long long)in->imm + nx->imm : 0;
+        if (nx != NULL && nx->op == MI_Addi && in->rd == in->rs && nx->rd == in->rd && nx->rs == in->rd &&
+            sum >= -32768 && sum <= 32767)
+        {
+            in->imm = (int)sum;
+            kill(nx, PH_AddiMerge);
+            if (in->imm == 0)
+                kill(in, PH_AddiMerge);
+            return true;
+        }
+        break;
+    }
+    case MI_Sw:
+        if (same_slot(in, nx))
+        {
+            // a load into another register stays as a move, nothing is removed
+            if (nx->rt == in->rt)
+                kill(nx, PH_StoreLoad);
+            else
+                to_move(nx, nx->rt, in->rt);
+            return true;
+        }
+        break;
+    case MI_J:
+        if (labels_have(j, in->label))
+        {
+            kill(in, PH_JumpNext);
+            return true;
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (mips_is_branch(in->op) && nx != NULL && nx->op == MI_J && labels_have(next(j), in->label))
+    {
+        // bcc L1; j L2; L1: -> b!cc L2; L1:
+        in->op = invert(in->op);
+        in->label = nx->label;
+        kill(nx, PH_BranchOverJump);
+        return true;
+    }
+
+    if (in->op == MI_J || in->op == MI_Jr)
+    {
+        bool changed = false;
+        for (; nx != NULL && nx->op != MI_Label; j = next(j), nx = at(j))
+        {
+            kill(nx, PH_Unreachable);
+            changed = true;
+        }
+        return changed;
+    }
+    return false;
+}
+
+void peephole_run(mips_list *l)
+{
+    list = l;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int i = 0; i < l->len; i++)
+        {
+            mips_instr *in = &l->data[i];
+            if (in->dead || is_comment(in))
+                continue;
+            if (rule_at(i))
+                changed = true;
+        }
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef __PEEPHOLE_H__
+#define __PEEPHOLE_H__
+
+#include "common.h"
+#include "mips.h"
+
+typedef enum
+{
+    PH_SelfMove,
+    PH_StoreLoad,
+    PH_PushPop,
+    PH_AddiMerge,
+    PH_JumpNext,
+    PH_BranchOverJump,
+    PH_Unreachable,
+    PH_COUNT
+} peephole_rule;
+
+extern const char *peephole_names[PH_COUNT];
+
+// Instructions removed by each rule, summed over all runs.
+extern int peephole_removed[PH_COUNT];
+
+// Marks redundant instructions of one function dead, until no rule
+// applies.
+void peephole_run(mips_list *l);
+
+#endif
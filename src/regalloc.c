@@ -0,0 +1,537 @@
+#include <stdlib.h>
+#include <string.h>
+#include "regalloc.h"
+#include "object.h"
+#include "debug.h"
+
+// Linear scan (Poletto and Sarkar) over one live interval per var.
+// Positions are doubled so that a var last used by a code can hand its
+// register to the var defined by the same code: code i reads at 2i and
+// writes at 2i+1.
+
+typedef struct
+{
+    irvar *var;
+    int start, end;
+    bool crosses_call;
+} interval;
+
+static ast *ra_tree = NULL;
+static regalloc *ra_result = NULL;
+
+// dense index of each var in the current function, by irvar id
+static int *local_of = NULL;
+static int *local_func = NULL;
+static irvar **locals = NULL;
+static int local_count = 0;
+static const int *ra_caller = NULL, *ra_callee = NULL;
+static int ra_caller_count = 0, ra_callee_count = 0;
+static bool is_callee_saved[32];
+static int func_counter = 0;
+
+static int words = 0;
+
+#pragma region operands
+
+static ircode *code_at(int index)
+{
+    return cast(ircode, ra_tree->codes[index]);
+}
+
+static irvar *op_use(irop *op)
+{
+    if (op == NULL || op->kind == IRO_Constant)
+        return NULL;
+    return op->var;
+}
+
+// The var a code writes, NULL if it writes through a pointer or nothing.
+static irvar *code_def(ircode *code)
+{
+    switch (code->kind)
+    {
+    case IR_Assign:
+        return code->assign.left->kind == IRO_Variable ? code->assign.left->var : NULL;
+    case IR_Add:
+    case IR_Sub:
+    case IR_Mul:
+    case IR_Div:
+        return code->bop.target->var;
+    case IR_Dec:
+        return code->dec.op->var;
+    case IR_Call:
+        return code->call.ret->var;
+    case IR_Param:
+        return code->param->var;
+    case IR_Read:
+        return code->read->var;
+    default:
+        return NULL;
+    }
+}
+
+static int code_uses(ircode *code, irvar **uses)
+{
+    irop *ops[2] = {NULL, NULL};
+    switch (code->kind)
+    {
+    case IR_Assign:
+        ops[0] = code->assign.right;
+        if (code->assign.left->kind == IRO_Deref)
+            ops[1] = code->assign.left;
+        break;
+    case IR_Add:
+    case IR_Sub:
+    case IR_Mul:
+    case IR_Div:
+        ops[0] = code->bop.op1;
+        ops[1] = code->bop.op2;
+        break;
+    case IR_Branch:
+        ops[0] = code->branch.op1;
+        ops[1] = code->branch.op2;
+        break;
+    case IR_Return:
+        ops[0] = code->ret;
+        break;
+    case IR_Arg:
+        ops[0] = code->arg;
+        break;
+    case IR_Write:
+        ops[0] = code->write;
+        break;
+    default:
+        break;
+    }
+    int count = 0;
+    for (int i = 0; i < 2; i++)
+    {
+        irvar *var = op_use(ops[i]);
+        if (var != NULL)
+            uses[count++] = var;
+    }
+    return count;
+}
+
+static int local(irvar *var)
+{
+    return local_of[var->id];
+}
+
+static void add_local(irvar *var, int func)
+{
+    if (var == NULL || local_func[var->id] == func)
+        return;
+    local_func[var->id] = func;
+    local_of[var->id] = local_count;
+    locals[local_count++] = var;
+}
+
+#pragma endregion
+
+#pragma region bitsets
+
+static unsigned int *set_at(unsigned int *sets, int index)
+{
+    return sets + (size_t)index * words;
+}
+
+static void set_add(unsigned int *set, int i)
+{
+    set[i >> 5] |= 1u << (i & 31);
+}
+
+static void set_remove(unsigned int *set, int i)
+{
+    set[i >> 5] &= ~(1u << (i & 31));
+}
+
+static bool set_has(unsigned int *set, int i)
+{
+    return (set[i >> 5] >> (i & 31)) & 1;
+}
+
+#pragma endregion
+
+static void compute_liveness(cfg_func *func, unsigned int *use, unsigned int *def, unsigned int *in, unsigned int *out)
+{
+    irvar *uses[2];
+    for (int i = 0; i < func->block_count; i++)
+    {
+        basic_block *b = func->blocks[i];
+        unsigned int *u = set_at(use, i), *d = set_at(def, i);
+        for (int k = b->begin; k < b->end; k++)
+        {
+            ircode *code = code_at(k);
+            if (code->ignore)
+                continue;
+            int count = code_uses(code, uses);
+            for (int j = 0; j < count; j++)
+            {
+                if (!set_has(d, local(uses[j])))
+                    set_add(u, local(uses[j]));
+            }
+            irvar *var = code_def(code);
+            if (var != NULL)
+                set_add(d, local(var));
+        }
+    }
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int i = func->block_count - 1; i >= 0; i--)
+        {
+            basic_block *b = func->blocks[i];
+            unsigned int *o = set_at(out, i), *n = set_at(in, i);
+            unsigned int *u = set_at(use, i), *d = set_at(def, i);
+            for (int w = 0; w < words; w++)
+            {
+                unsigned int x = 0;
+                for (int j = 0; j < b->succ_count; j++)
+                    x |= set_at(in, b->succs[j]->id)[w];
+                o[w] = x;
+                unsigned int y = u[w] | (x & ~d[w]);
+                if (y != n[w])
+                {
+                    n[w] = y;
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+static void extend(interval *it, int pos)
+{
+    if (pos < it->start)
+        it->start = pos;
+    if (pos > it->end)
+        it->end = pos;
+}
+
+static void build_intervals(cfg_func *func, unsigned int *out, interval *its)
+{
+    irvar *uses[2];
+    unsigned int *live = newvalarr(unsigned int, words);
+    for (int i = 0; i < func->block_count; i++)
+    {
+        basic_block *b = func->blocks[i];
+        memcpy(live, set_at(out, i), sizeof(unsigned int) * words);
+        for (int l = 0; l < local_count; l++)
+        {
+            if (set_has(live, l))
+                extend(&its[l], 2 * (b->end - 1) + 1);
+        }
+        for (int k = b->end - 1; k >= b->begin; k--)
+        {
+            ircode *code = code_at(k);
+            if (code->ignore)
+                continue;
+            irvar *var = code_def(code);
+            if (var != NULL)
+            {
+                extend(&its[local(var)], 2 * k + 1);
+                set_remove(live, local(var));
+            }
+            if (code->kind == IR_Call)
+            {
+                vector *saves = new_vector();
+                for (int l = 0; l < local_count; l++)
+                {
+                    if (set_has(live, l))
+                    {
+                        vector_push(saves, locals[l]);
+                        its[l].crosses_call = true;
+                    }
+                }
+                ra_result->saves[k] = saves;
+            }
+            int count = code_uses(code, uses);
+            for (int j = 0; j < count; j++)
+            {
+                extend(&its[local(uses[j])], 2 * k);
+                set_add(live, local(uses[j]));
+            }
+        }
+        for (int l = 0; l < local_count; l++)
+        {
+            if (set_has(live, l))
+                extend(&its[l], 2 * b->begin);
+        }
+    }
+    delete (live);
+}
+
+static int start_cmp(const void *a, const void *b)
+{
+    const interval *ia = *(const interval **)a;
+    const interval *ib = *(const interval **)b;
+    if (ia->start != ib->start)
+        return ia->start - ib->start;
+    return ia->var->id - ib->var->id;
+}
+
+// Free registers of one class, used as a stack.
+typedef struct
+{
+    int *regs;
+    int count;
+} reg_stack;
+
+static reg_stack new_stack(const int *pool, int pool_size)
+{
+    reg_stack st;
+    st.regs = newvalarr(int, pool_size == 0 ? 1 : pool_size);
+    st.count = pool_size;
+    for (int i = 0; i < pool_size; i++)
+        st.regs[i] = pool[pool_size - 1 - i];
+    return st;
+}
+
+static int take_reg(interval *it, reg_stack *caller, reg_stack *callee)
+{
+    reg_stack *first = it->crosses_call ? callee : caller;
+    reg_stack *second = it->crosses_call ? caller : callee;
+    if (first->count > 0)
+        return first->regs[--first->count];
+    if (second->count > 0)
+        return second->regs[--second->count];
+    return -1;
+}
+
+static void linear_scan(interval *its)
+{
+    interval **sorted = newarr(interval, local_count == 0 ? 1 : local_count);
+    int count = 0;
+    for (int l = 0; l < local_count; l++)
+    {
+        if (its[l].end >= 0)
+            sorted[count++] = &its[l];
+    }
+    qsort(sorted, count, sizeof(interval *), start_cmp);
+
+    // active intervals ordered by end
+    int pool_size = ra_caller_count + ra_callee_count;
+    interval **active = newarr(interval, pool_size + 1);
+    int active_count = 0;
+    reg_stack caller = new_stack(ra_caller, ra_caller_count);
+    reg_stack callee = new_stack(ra_callee, ra_callee_count);
+
+    int *reg_of = ra_result->reg_of;
+    for (int i = 0; i < count; i++)
+    {
+        interval *cur = sorted[i];
+        int expired = 0;
+        while (expired < active_count && active[expired]->end < cur->start)
+        {
+            int r = reg_of[active[expired]->var->id];
+            reg_stack *st = is_callee_saved[r] ? &callee : &caller;
+            st->regs[st->count++] = r;
+            expired++;
+        }
+        for (int j = expired; j < active_count; j++)
+            active[j - expired] = active[j];
+        active_count -= expired;
+
+        int r = take_reg(cur, &caller, &callee);
+        if (r >= 0)
+            reg_of[cur->var->id] = r;
+        else if (active_count > 0 && active[active_count - 1]->end > cur->end)
+        {
+            // the interval ending last gives up its register
+            interval *spill = active[--active_count];
+            reg_of[cur->var->id] = reg_of[spill->var->id];
+            reg_of[spill->var->id] = -1;
+            ra_result->spill_count++;
+        }
+        else
+        {
+            reg_of[cur->var->id] = -1;
+            ra_result->spill_count++;
+            continue;
+        }
+
+        int j = active_count;
+        while (j > 0 && active[j - 1]->end > cur->end)
+        {
+            active[j] = active[j - 1];
+            j--;
+        }
+        active[j] = cur;
+        active_count++;
+    }
+
+    delete (sorted);
+    delete (active);
+    delete (caller.regs);
+    delete (callee.regs);
+}
+
+// Keeps the vars in caller-saved registers, the callee keeps the frame and
+// the callee-saved registers.
+static void filter_saves(cfg_func *func)
+{
+    int *reg_of = ra_result->reg_of;
+    for (int i = func->begin; i < func->end; i++)
+    {
+        vector *saves = ra_result->saves[i];
+        if (saves == NULL)
+            continue;
+        int len = 0;
+        for (int j = 0; j < saves->len; j++)
+        {
+            irvar *var = cast(irvar, saves->data[j]);
+            if (reg_of[var->id] >= 0 && !is_callee_saved[reg_of[var->id]])
+                saves->data[len++] = var;
+        }
+        saves->len = len;
+    }
+}
+
+// Frame above the reserved bytes: callee-saved registers, slots of vars in
+// memory, the save area, then the DEC arrays, so the small slots keep
+// small offsets.
+static void layout_frame(cfg_func *func, int reserved)
+{
+    bool used[32];
+    memset(used, 0, sizeof(used));
+    for (int l = 0; l < local_count; l++)
+    {
+        int r = ra_result->reg_of[locals[l]->id];
+        if (r >= 0 && is_callee_saved[r])
+            used[r] = true;
+    }
+    ra_result->callee_count = 0;
+    for (int i = 0; i < ra_callee_count; i++)
+    {
+        if (used[ra_callee[i]])
+            ra_result->callee_regs[ra_result->callee_count++] = ra_callee[i];
+    }
+
+    int offset = reserved;
+    ra_result->callee_offset = offset;
+    offset += 4 * ra_result->callee_count;
+    for (int l = 0; l < local_count; l++)
+    {
+        irvar *var = locals[l];
+        if (ra_result->reg_of[var->id] < 0)
+        {
+            ra_result->slot_of[var->id] = offset;
+            offset += 4;
+        }
+    }
+
+    int save_count = 0;
+    for (int i = func->begin; i < func->end; i++)
+    {
+        vector *saves = ra_result->saves[i];
+        if (saves != NULL && saves->len > save_count)
+            save_count = saves->len;
+    }
+    ra_result->save_offset = offset;
+    offset += 4 * save_count;
+
+    for (int i = func->begin; i < func->end; i++)
+    {
+        ircode *code = code_at(i);
+        if (code->ignore || code->kind != IR_Dec)
+            continue;
+        ra_result->array_of[code->dec.op->var->id] = offset;
+        offset += code->dec.size;
+    }
+    ra_result->frame_size = offset;
+}
+
+void regalloc_func(regalloc *ra, cfg_func *func, int reserved)
+{
+    Assert(ra == ra_result, "regalloc of another tree");
+    int func_index = func_counter++;
+    local_count = 0;
+    for (int i = func->begin; i < func->end; i++)
+    {
+        ircode *code = code_at(i);
+        if (code->ignore)
+            continue;
+        irvar *uses[2];
+        int count = code_uses(code, uses);
+        for (int j = 0; j < count; j++)
+            add_local(uses[j], func_index);
+        add_local(code_def(code), func_index);
+    }
+    for (int l = 0; l < local_count; l++)
+        ra->reg_of[locals[l]->id] = -1;
+
+    if (local_count > 0)
+    {
+        words = (local_count + 31) / 32;
+        int n = func->block_count * words;
+        unsigned int *use = newvalarr(unsigned int, n);
+        unsigned int *def = newvalarr(unsigned int, n);
+        unsigned int *in = newvalarr(unsigned int, n);
+        unsigned int *out = newvalarr(unsigned int, n);
+        memset(use, 0, sizeof(unsigned int) * n);
+        memset(def, 0, sizeof(unsigned int) * n);
+        memset(in, 0, sizeof(unsigned int) * n);
+        memset(out, 0, sizeof(unsigned int) * n);
+        compute_liveness(func, use, def, in, out);
+
+        interval *its = newvalarr(interval, local_count);
+        for (int l = 0; l < local_count; l++)
+        {
+            its[l].var = locals[l];
+            its[l].start = 0x7fffffff;
+            its[l].end = -1;
+            its[l].crosses_call = false;
+        }
+        build_intervals(func, out, its);
+        linear_scan(its);
+        filter_saves(func);
+
+        delete (use);
+        delete (def);
+        delete (in);
+        delete (out);
+        delete (its);
+    }
+    layout_frame(func, reserved);
+}
+
+regalloc *regalloc_new(ast *tree, const int *caller_saved, int caller_count, const int *callee_saved, int callee_count)
+{
+    ra_tree = tree;
+    ra_caller = caller_saved;
+    ra_caller_count = caller_count;
+    ra_callee = callee_saved;
+    ra_callee_count = callee_count;
+    memset(is_callee_saved, 0, sizeof(is_callee_saved));
+    for (int i = 0; i < callee_count; i++)
+        is_callee_saved[callee_saved[i]] = true;
+    func_counter = 0;
+    ra_result = new (regalloc);
+    int var_slots = tree->var_count + 1;
+    ra_result->reg_of = newvalarr(int, var_slots);
+    ra_result->slot_of = newvalarr(int, var_slots);
+    ra_result->array_of = newvalarr(int, var_slots);
+    ra_result->saves = newarr(vector, tree->len == 0 ? 1 : tree->len);
+    ra_result->save_offset = 0;
+    ra_result->callee_count = 0;
+    ra_result->callee_regs = newvalarr(int, callee_count == 0 ? 1 : callee_count);
+    ra_result->callee_offset = 0;
+    ra_result->frame_size = 0;
+    ra_result->spill_count = 0;
+    local_of = newvalarr(int, var_slots);
+    local_func = newvalarr(int, var_slots);
+    locals = newarr(irvar, var_slots);
+    for (int i = 0; i < var_slots; i++)
+    {
+        ra_result->reg_of[i] = -1;
+        ra_result->slot_of[i] = -1;
+        ra_result->array_of[i] = -1;
+        local_func[i] = -1;
+    }
+    for (int i = 0; i < tree->len; i++)
+        ra_result->saves[i] = NULL;
+    return ra_result;
+}
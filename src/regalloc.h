@@ -0,0 +1,39 @@
+#ifndef __REGALLOC_H__
+#define __REGALLOC_H__
+
+#include "common.h"
+#include "ast.h"
+#include "cfg.h"
+
+// Storage of the vars of one function at a time, regalloc_func fills it
+// in again for every function.
+typedef struct
+{
+    // register of each var by irvar id, -1 if the var lives in the frame
+    int *reg_of;
+    // frame offset of each var living in the frame, by irvar id
+    int *slot_of;
+    // frame offset of the array each DEC var points to, by irvar id
+    int *array_of;
+    // vars in caller-saved registers live across the CALL at each code
+    // index, saved in order from save_offset, NULL for other codes
+    vector **saves;
+    int save_offset;
+    // callee-saved registers the function writes, saved in order from
+    // callee_offset
+    int callee_count;
+    int *callee_regs;
+    int callee_offset;
+    int frame_size;
+    int spill_count;
+} regalloc;
+
+// Vars crossing a call prefer the callee-saved registers, the others
+// prefer the caller-saved ones.
+regalloc *regalloc_new(ast *tree, const int *caller_saved, int caller_count, const int *callee_saved, int callee_count);
+
+// Allocates the vars of func. The frame starts with reserved bytes left
+// to the caller of regalloc_func.
+void regalloc_func(regalloc *ra, cfg_func *func, int reserved);
+
+#endif
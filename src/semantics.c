@@ -9,19 +9,20 @@
 #include "common.h"
 #include "debug.h"
 #include "object.h"
+#include "intern.h"
 
 static void semantics_error(int type, int lineno, char *format, ...);
 static void semantics_log(int lineno, char *format, ...);
 
 #pragma region error functions
 
-static void error_var_nodef(int lineno, char *name)
+static void error_var_nodef(int lineno, const char *name)
 {
     semantics_error(1, lineno, "No def var: %s", name);
 }
-static void error_func_nodef(int lineno, char *name) { semantics_error(2, lineno, "No def func: %s", name); }
-static void error_var_redef(int lineno, char *name) { semantics_error(3, lineno, "Re def var: %s", name); }
-static void error_func_redef(int lineno, char *name) { semantics_error(4, lineno, "Re def func: %s", name); }
+static void error_func_nodef(int lineno, const char *name) { semantics_error(2, lineno, "No def func: %s", name); }
+static void error_var_redef(int lineno, const char *name) { semantics_error(3, lineno, "Re def var: %s", name); }
+static void error_func_redef(int lineno, const char *name) { semantics_error(4, lineno, "Re def func: %s", name); }
 static void error_assign_type(int lineno) { semantics_error(5, lineno, "assign type not match"); }
 static void error_assign_rval(int lineno) { semantics_error(6, lineno, "assign to rval"); }
 static void error_op_type(int lineno) { semantics_error(7, lineno, "op type not match"); }
@@ -31,12 +32,12 @@ static void error_index(int lineno) { semantics_error(10, lineno, "not indexable
 static void error_call(int lineno) { semantics_error(11, lineno, "not callable"); }
 static void error_index_arg(int lineno) { semantics_error(12, lineno, "not integer in index"); }
 static void error_member(int lineno) { semantics_error(13, lineno, "not memberable"); }
-static void error_member_nodef(int lineno, char *name) { semantics_error(14, lineno, "no member: %s", name); }
-static void error_member_def(int lineno, char *name) { semantics_error(15, lineno, "invalid member def"); }
-static void error_struct_redef(int lineno, char *name) { semantics_error(16, lineno, "struct redef"); }
-static void error_struct_nodef(int lineno, char *name) { semantics_error(17, lineno, "struct nodef: %s", name); }
-static void error_func_decnodef(int lineno, char *name) { semantics_error(18, lineno, "func dec but no def"); }
-static void error_func_decconflict(int lineno, char *name) { semantics_error(19, lineno, "func dec conflict"); }
+static void error_member_nodef(int lineno, const char *name) { semantics_error(14, lineno, "no member: %s", name); }
+static void error_member_def(int lineno, const char *name) { semantics_error(15, lineno, "invalid member def"); }
+static void error_struct_redef(int lineno, const char *name) { semantics_error(16, lineno, "struct redef"); }
+static void error_struct_nodef(int lineno, const char *name) { semantics_error(17, lineno, "struct nodef: %s", name); }
+static void error_func_decnodef(int lineno, const char *name) { semantics_error(18, lineno, "func dec but no def"); }
+static void error_func_decconflict(int lineno, const char *name) { semantics_error(19, lineno, "func dec conflict"); }
 
 #pragma endregion
 
@@ -162,15 +163,13 @@ static void analyse_Program(syntax_tree *tree, env *ev)
     tree->ev = ev;
     analyse_ExtDefList(tree->children[0], ev);
 
-    list *cur = ev->syms->table;
-    while (cur != NULL)
+    for (int i = ev->syms->len - 1; i >= 0; i--)
     {
-        symbol *sym = cast(symbol, cur->obj);
+        symbol *sym = ev->syms->syms[i];
         if (sym->tp->cls == TC_FUNC && sym->state == SS_DEC)
         {
             error_func_decnodef(sym->lineno, sym->name);
         }
-        cur = cur->next;
     }
 }
 static void analyse_ExtDefList(syntax_tree *tree, env *ev)
@@ -407,9 +406,7 @@ static SES_Tag *analyse_OptTag(syntax_tree *tree, env *ev)
     if (tree->count == 0)
     {
         struct_id++;
-        sytd_id *name = new (sytd_id);
-        sprintf(*name, "@STRUCT%d", struct_id);
-        *tag = *name;
+        *tag = internf("@STRUCT%d", struct_id);
     }
     else
     {
@@ -442,7 +439,7 @@ static SES_VarDec *analyse_VarDec(syntax_tree *tree, env *ev)
     bool invardec = ev->in_vardec;
     if (tree->count == 1)
     {
-        char *name = *cast(sytd_id, tree->children[0]->data);
+        const char *name = *cast(sytd_id, tree->children[0]->data);
         SES_VarDec *tag = new (SES_VarDec);
         if (invardec)
         {
@@ -503,7 +500,7 @@ static SES_FunDec *analyse_FunDec(syntax_tree *tree, env *ev)
     AssertEq(tree->type, ST_FunDec);
     tree->ev = ev;
 
-    char *name = *cast(sytd_id, tree->children[0]->data);
+    const char *name = *cast(sytd_id, tree->children[0]->data);
     SES_FunDec *tag = new (SES_FunDec);
     tag->lineno = tree->first_line;
 
@@ -781,7 +778,7 @@ symbol *get_symbol_by_id(syntax_tree *tree, env *ev)
 {
     AssertEq(tree->type, ST_ID);
     tree->ev = ev;
-    char *name = *cast(sytd_id, tree->data);
+    const char *name = *cast(sytd_id, tree->data);
     symbol *val = st_find(ev->syms, name);
     return val;
 }
@@ -904,7 +901,7 @@ static SES_Exp *analyse_Exp(syntax_tree *tree, env *ev)
             case ST_DOT: // Exp DOT ID
             {
                 SES_Exp *exp = analyse_Exp(tree->children[0], ev);
-                char *name = *cast(sytd_id, tree->children[2]->data);
+                const char *name = *cast(sytd_id, tree->children[2]->data);
                 if (!type_can_member(exp->tp))
                 {
                     error_member(tree->first_line);
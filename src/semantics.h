@@ -8,7 +8,7 @@ typedef type *SES_TYPE;
 typedef struct
 {
     type *tp;
-    char *struct_name;
+    const char *struct_name;
 } SES_Specifier;
 
 typedef struct
@@ -18,7 +18,7 @@ typedef struct
     env *ev;
 } SES_FunDec;
 
-typedef char *SES_Tag;
+typedef const char *SES_Tag;
 
 typedef struct __SES_Exp
 {
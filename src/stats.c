@@ -0,0 +1,197 @@
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "stats.h"
+#include "debug.h"
+
+#define STATS_PHASES 16
+#define STATS_IRS 8
+// Open addressing on the type name pointer, a power of two. The same name
+// may come from string literals of several files; they are merged by
+// strcmp only when reporting.
+#define STATS_TYPES 512
+
+typedef struct
+{
+    const char *type_name;
+    int count;
+    size_t bytes;
+} type_stat;
+
+typedef struct
+{
+    const char *name;
+    double wall, cpu;
+    long peak_rss;
+    int objects;
+    size_t bytes;
+    type_stat types[STATS_TYPES];
+} phase_stat;
+
+typedef struct
+{
+    const char *when;
+    int count;
+} ir_stat;
+
+bool stats_enabled = false;
+
+static phase_stat phases[STATS_PHASES];
+static int phase_count = 0;
+static phase_stat *current = NULL;
+
+static ir_stat irs[STATS_IRS];
+static int ir_count = 0;
+
+static double wall_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double cpu_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long peak_rss()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static void end_phase()
+{
+    if (current == NULL)
+        return;
+    current->wall = wall_now() - current->wall;
+    current->cpu = cpu_now() - current->cpu;
+    current->peak_rss = peak_rss();
+    current = NULL;
+}
+
+void stats_enable()
+{
+    stats_enabled = true;
+}
+
+void stats_phase(const char *name)
+{
+    if (!stats_enabled)
+        return;
+    end_phase();
+    Assert(phase_count < STATS_PHASES, "too many phases");
+    current = &phases[phase_count++];
+    current->name = name;
+    current->wall = wall_now();
+    current->cpu = cpu_now();
+}
+
+void stats_object(const char *type_name, size_t size)
+{
+    if (!stats_enabled)
+        return;
+    if (current == NULL)
+        stats_phase("startup");
+    current->objects++;
+    current->bytes += size;
+
+    unsigned int slot = ((size_t)type_name >> 3) & (STATS_TYPES - 1);
+    for (int i = 0; i < STATS_TYPES; i++)
+    {
+        type_stat *ts = &current->types[slot];
+        if (ts->type_name == NULL)
+            ts->type_name = type_name;
+        if (ts->type_name == type_name)
+        {
+            ts->count++;
+            ts->bytes += size;
+            return;
+        }
+        slot = (slot + 1) & (STATS_TYPES - 1);
+    }
+    Assert(false, "too many object types");
+}
+
+void stats_ir(const char *when, int count)
+{
+    if (!stats_enabled || ir_count == STATS_IRS)
+        return;
+    irs[ir_count].when = when;
+    irs[ir_count].count = count;
+    ir_count++;
+}
+
+static int compare_bytes(const void *a, const void *b)
+{
+    const type_stat *x = a, *y = b;
+    if (x->bytes != y->bytes)
+        return x->bytes < y->bytes ? 1 : -1;
+    return strcmp(x->type_name, y->type_name);
+}
+
+// Merges the slots of one name into a packed array sorted by bytes.
+static int collect_types(phase_stat *phase, type_stat *result)
+{
+    int len = 0;
+    for (int i = 0; i < STATS_TYPES; i++)
+    {
+        type_stat *ts = &phase->types[i];
+        if (ts->type_name == NULL)
+            continue;
+        int j = 0;
+        while (j < len && strcmp(result[j].type_name, ts->type_name) != 0)
+            j++;
+        if (j == len)
+        {
+            result[len++] = *ts;
+            continue;
+        }
+        result[j].count += ts->count;
+        result[j].bytes += ts->bytes;
+    }
+    qsort(result, len, sizeof(type_stat), compare_bytes);
+    return len;
+}
+
+void stats_report(FILE *out)
+{
+    if (!stats_enabled)
+        return;
+    end_phase();
+
+    static type_stat types[STATS_TYPES];
+    double wall = 0, cpu = 0;
+    int objects = 0;
+    size_t bytes = 0;
+
+    fprintf(out, "%-12s %10s %10s %10s %12s %12s\n", "phase", "wall ms", "cpu ms", "objects", "bytes", "peak rss KB");
+    for (int i = 0; i < phase_count; i++)
+    {
+        phase_stat *p = &phases[i];
+        fprintf(out, "%-12s %10.3f %10.3f %10d %12zu %12ld\n", p->name, p->wall * 1e3, p->cpu * 1e3, p->objects, p->bytes, p->peak_rss);
+        wall += p->wall;
+        cpu += p->cpu;
+        objects += p->objects;
+        bytes += p->bytes;
+    }
+    fprintf(out, "%-12s %10.3f %10.3f %10d %12zu %12ld\n", "total", wall * 1e3, cpu * 1e3, objects, bytes, peak_rss());
+
+    for (int i = 0; i < ir_count; i++)
+        fprintf(out, "ir codes %-10s %d\n", irs[i].when, irs[i].count);
+
+    for (int i = 0; i < phase_count; i++)
+    {
+        int len = collect_types(&phases[i], types);
+        if (len == 0)
+            continue;
+        fprintf(out, "\nobjects in %s\n", phases[i].name);
+        for (int j = 0; j < len; j++)
+            fprintf(out, "  %-24s %10d %12zu\n", types[j].type_name, types[j].count, types[j].bytes);
+    }
+}
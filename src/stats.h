@@ -0,0 +1,26 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdio.h>
+#include "common.h"
+
+// Numbers behind --stats. The driver moves through phases with
+// stats_phase; each phase records wall and CPU time, the objects created
+// through newobj by type name and the peak RSS when it ends. All calls
+// are no-ops until stats_enable.
+
+extern bool stats_enabled;
+
+void stats_enable();
+
+// Ends the current phase, if any, and starts the named one.
+void stats_phase(const char *name);
+
+void stats_object(const char *type_name, size_t size);
+
+// IR code count at a point of the pipeline, e.g. before optimize.
+void stats_ir(const char *when, int count);
+
+void stats_report(FILE *out);
+
+#endif
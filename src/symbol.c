@@ -4,11 +4,13 @@
 #include "symbol.h"
 #include "common.h"
 #include "object.h"
+#include "intern.h"
+#include "hash.h"
 
-symbol *new_symbol(char *name, int lineno, type *tp, symbol_state state)
+symbol *new_symbol(const char *name, int lineno, type *tp, symbol_state state)
 {
     symbol *result = new (symbol);
-    strcpy(result->name, name);
+    result->name = intern(name);
     result->lineno = lineno;
     result->tp = tp;
     result->state = state;
@@ -19,31 +21,79 @@ symbol_table *new_symbol_table(symbol_table *parent)
 {
     symbol_table *result = new (symbol_table);
     result->parent = parent;
-    result->table = NULL;
+    result->len = 0;
+    result->capacity = 0;
+    result->syms = NULL;
+    result->slot_count = 0;
+    result->slots = NULL;
     return result;
 }
 
-symbol *st_findonly(symbol_table *table, char *name)
+// names are interned, so the pointer itself is the key
+static int st_slot(symbol_table *table, const char *name)
 {
-    list *cur = table->table;
-    while (cur != NULL)
+    int mask = table->slot_count - 1;
+    int i = hash_pointer(name) & mask;
+    while (table->slots[i] != -1)
     {
-        symbol *sym = cast(symbol, cur->obj);
-        if (strcmp(sym->name, name) == 0)
-            return sym;
-        cur = cur->next;
+        if (table->syms[table->slots[i]]->name == name)
+            return i;
+        i = (i + 1) & mask;
     }
-    return NULL;
+    return i;
+}
+
+static void st_rehash(symbol_table *table, int slot_count)
+{
+    if (table->slots != NULL)
+        delete (table->slots);
+    table->slot_count = slot_count;
+    table->slots = newvalarr(int, slot_count);
+    for (int i = 0; i < slot_count; i++)
+        table->slots[i] = -1;
+    int mask = slot_count - 1;
+    for (int k = 0; k < table->len; k++)
+    {
+        int i = hash_pointer(table->syms[k]->name) & mask;
+        while (table->slots[i] != -1)
+            i = (i + 1) & mask;
+        table->slots[i] = k;
+    }
+}
+
+static void st_grow(symbol_table *table)
+{
+    int capacity = table->capacity == 0 ? 4 : table->capacity * 2;
+    symbol **syms = newarr(symbol, capacity);
+    for (int k = 0; k < table->len; k++)
+        syms[k] = table->syms[k];
+    if (table->syms != NULL)
+        delete (table->syms);
+    table->syms = syms;
+    table->capacity = capacity;
+}
+
+symbol *st_findonly(symbol_table *table, const char *name)
+{
+    if (table->len == 0)
+        return NULL;
+    int i = st_slot(table, name);
+    if (table->slots[i] == -1)
+        return NULL;
+    return table->syms[table->slots[i]];
 }
 
-symbol *st_find(symbol_table *table, char *name)
+symbol *st_find(symbol_table *table, const char *name)
 {
     symbol_table *cur = table;
     while (cur != NULL)
     {
-        symbol *res = st_findonly(cur, name);
-        if (res != NULL)
-            return res;
+        if (cur->len > 0)
+        {
+            int i = st_slot(cur, name);
+            if (cur->slots[i] != -1)
+                return cur->syms[cur->slots[i]];
+        }
         cur = cur->parent;
     }
     return NULL;
@@ -51,37 +101,33 @@ symbol *st_find(symbol_table *table, char *name)
 
 void st_add(symbol_table *table, symbol *sym)
 {
-    AssertIsNull(st_findonly(table, sym->name));
-
     // printf("st->push %s\n", sym->name);
 
-    table->table = list_pushfront(table->table, sym);
+    if (table->len == table->capacity)
+        st_grow(table);
+    // keep the load factor of slots at most 1/2
+    if ((table->len + 1) * 2 > table->slot_count)
+        st_rehash(table, table->slot_count == 0 ? 8 : table->slot_count * 2);
+
+    int i = st_slot(table, sym->name);
+    AssertEq(table->slots[i], -1);
+
+    table->syms[table->len] = sym;
+    table->slots[i] = table->len;
+    table->len++;
 }
 
 int st_len(symbol_table *table)
 {
-    list *cur = table->table;
-    int ans = 0;
-    while (cur != NULL)
-    {
-        ans++;
-        cur = cur->next;
-    }
-    return ans;
+    return table->len;
 }
 
 symbol **st_to_arr(symbol_table *table)
 {
     int len = st_len(table);
     symbol **result = newarr(symbol, len);
-    list *cur = table->table;
-    int i = 0;
-    while (cur != NULL)
-    {
-        result[i] = cast(symbol, cur->obj);
-        cur = cur->next;
-        i++;
-    }
+    for (int i = 0; i < len; i++)
+        result[i] = table->syms[len - 1 - i];
     return result;
 }
 
@@ -89,13 +135,7 @@ symbol **st_revto_arr(symbol_table *table)
 {
     int len = st_len(table);
     symbol **result = newarr(symbol, len);
-    list *cur = table->table;
-    int i = 0;
-    while (cur != NULL)
-    {
-        result[len - 1 - i] = cast(symbol, cur->obj);
-        cur = cur->next;
-        i++;
-    }
+    for (int i = 0; i < len; i++)
+        result[i] = table->syms[i];
     return result;
-}
\ No newline at end of file
+}
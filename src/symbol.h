@@ -36,7 +36,12 @@ struct __symbol_table;
 typedef struct __type
 {
     type_class cls;
+    // hash of the shape, ignoring names and array lengths
     ll hash;
+    // ANY or NEVER appears somewhere inside
+    bool wild;
+    // size in bytes, -1 if the type has no size
+    int size;
     union {
         metatype_type metatype;
         struct
@@ -55,6 +60,12 @@ typedef struct __type
         {
             int memc;
             struct __symbol **mems;
+            // offsets[i] is the offset of mems[i]
+            int *offsets;
+            // open-addressing index into mems keyed by the interned name
+            // pointer, -1 for empty slots
+            int mem_slot_count;
+            int *mem_slots;
         };
         struct
         {
@@ -71,7 +82,7 @@ typedef enum
 
 typedef struct __symbol
 {
-    char name[64];
+    const char *name;
     int lineno;
     type *tp;
     symbol_state state;
@@ -81,16 +92,23 @@ typedef struct __symbol
 typedef struct __symbol_table
 {
     struct __symbol_table *parent;
-    list *table;
+    // symbols in insertion order
+    int len, capacity;
+    symbol **syms;
+    // open-addressing index into syms keyed by the interned name pointer,
+    // -1 for empty slots
+    int slot_count;
+    int *slots;
 } symbol_table;
 
-symbol *new_symbol(char *name, int lineno, type *tp, symbol_state state);
+symbol *new_symbol(const char *name, int lineno, type *tp, symbol_state state);
 
 symbol_table *new_symbol_table(symbol_table *parent);
 
-symbol *st_find(symbol_table *table, char *name);
+// name must be interned
+symbol *st_find(symbol_table *table, const char *name);
 
-symbol *st_findonly(symbol_table *table, char *name);
+symbol *st_findonly(symbol_table *table, const char *name);
 
 int st_len(symbol_table *table);
 
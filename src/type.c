@@ -5,12 +5,238 @@
 #include "type.h"
 #include "debug.h"
 #include "object.h"
+#include "hash.h"
 
 static type *unit = NULL;
 static type *any = NULL;
 static type *never = NULL;
 static type *metaint = NULL, *metafloat = NULL;
 
+// Types are hash-consed: structurally identical types (including member
+// names, argument names and array lengths) share one canonical object.
+typedef struct
+{
+    ll key;
+    type *tp;
+} type_slot;
+
+static type_slot *slots = NULL;
+static int slot_count = 0, type_count = 0;
+
+static const ll SEED = 1000003;
+
+static ll type_key(type *a)
+{
+    hasher h = {SEED, 0, 0};
+    hash(&h, a->cls);
+    switch (a->cls)
+    {
+    case TC_META:
+        hash(&h, a->metatype);
+        break;
+    case TC_ARRAY:
+        hash(&h, (ll)(size_t)a->base);
+        for (int i = 0; i < a->rank; i++)
+            hash(&h, a->lens[i]);
+        break;
+    case TC_FUNC:
+        hash(&h, (ll)(size_t)a->ret);
+        for (int i = 0; i < a->argc; i++)
+        {
+            hash(&h, (ll)(size_t)a->args[i]->name);
+            hash(&h, (ll)(size_t)a->args[i]->tp);
+        }
+        break;
+    case TC_STRUCT:
+        for (int i = 0; i < a->memc; i++)
+        {
+            hash(&h, (ll)(size_t)a->mems[i]->name);
+            hash(&h, (ll)(size_t)a->mems[i]->tp);
+        }
+        break;
+    case TC_TYPE:
+        hash(&h, (ll)(size_t)a->tp);
+        break;
+    }
+    return h.result;
+}
+
+static bool type_same(type *a, type *b)
+{
+    if (a->cls != b->cls)
+        return false;
+    switch (a->cls)
+    {
+    case TC_META:
+        return a->metatype == b->metatype;
+    case TC_ARRAY:
+        if (a->base != b->base || a->rank != b->rank)
+            return false;
+        for (int i = 0; i < a->rank; i++)
+            if (a->lens[i] != b->lens[i])
+                return false;
+        return true;
+    case TC_FUNC:
+        if (a->ret != b->ret || a->argc != b->argc)
+            return false;
+        for (int i = 0; i < a->argc; i++)
+            if (a->args[i]->name != b->args[i]->name || a->args[i]->tp != b->args[i]->tp)
+                return false;
+        return true;
+    case TC_STRUCT:
+        if (a->memc != b->memc)
+            return false;
+        for (int i = 0; i < a->memc; i++)
+            if (a->mems[i]->name != b->mems[i]->name || a->mems[i]->tp != b->mems[i]->tp)
+                return false;
+        return true;
+    case TC_TYPE:
+        return a->tp == b->tp;
+    default:
+        return true;
+    }
+}
+
+static void type_shape(type *a)
+{
+    hasher h = {SEED, 0, 0};
+    hash(&h, a->cls);
+    a->wild = a->cls == TC_ANY || a->cls == TC_NEVER;
+    switch (a->cls)
+    {
+    case TC_META:
+        hash(&h, a->metatype);
+        break;
+    case TC_ARRAY:
+        hash(&h, a->rank);
+        hash(&h, a->base->hash);
+        a->wild |= a->base->wild;
+        break;
+    case TC_FUNC:
+        hash(&h, a->argc);
+        hash(&h, a->ret->hash);
+        a->wild |= a->ret->wild;
+        for (int i = 0; i < a->argc; i++)
+        {
+            hash(&h, a->args[i]->tp->hash);
+            a->wild |= a->args[i]->tp->wild;
+        }
+        break;
+    case TC_STRUCT:
+        hash(&h, a->memc);
+        for (int i = 0; i < a->memc; i++)
+        {
+            hash(&h, a->mems[i]->tp->hash);
+            a->wild |= a->mems[i]->tp->wild;
+        }
+        break;
+    case TC_TYPE:
+        hash(&h, a->tp->hash);
+        a->wild |= a->tp->wild;
+        break;
+    }
+    a->hash = h.result;
+}
+
+static void type_layout(type *a)
+{
+    switch (a->cls)
+    {
+    case TC_META:
+        a->size = 4;
+        break;
+    case TC_ARRAY:
+        a->size = a->base->size;
+        for (int i = 0; i < a->rank && a->size >= 0; i++)
+            a->size *= a->lens[i];
+        break;
+    case TC_STRUCT:
+    {
+        a->size = 0;
+        a->offsets = newvalarr(int, a->memc);
+        for (int i = 0; i < a->memc; i++)
+        {
+            a->offsets[i] = a->size;
+            if (a->size >= 0)
+                a->size = a->mems[i]->tp->size < 0 ? -1 : a->size + a->mems[i]->tp->size;
+        }
+        a->mem_slot_count = 4;
+        while (a->mem_slot_count < a->memc * 2)
+            a->mem_slot_count *= 2;
+        a->mem_slots = newvalarr(int, a->mem_slot_count);
+        int mask = a->mem_slot_count - 1;
+        for (int i = 0; i < a->mem_slot_count; i++)
+            a->mem_slots[i] = -1;
+        for (int i = 0; i < a->memc; i++)
+        {
+            int k = hash_pointer(a->mems[i]->name) & mask;
+            while (a->mem_slots[k] != -1)
+                k = (k + 1) & mask;
+            a->mem_slots[k] = i;
+        }
+        break;
+    }
+    default:
+        a->size = -1;
+        break;
+    }
+}
+
+static void grow_slots()
+{
+    int old_count = slot_count;
+    type_slot *old = slots;
+    slot_count = slot_count == 0 ? 256 : slot_count * 2;
+    slots = calloc(slot_count, sizeof(type_slot));
+    Assert(slots != NULL, "out of memory");
+    int mask = slot_count - 1;
+    for (int i = 0; i < old_count; i++)
+    {
+        if (old[i].tp == NULL)
+            continue;
+        int k = old[i].key & mask;
+        while (slots[k].tp != NULL)
+            k = (k + 1) & mask;
+        slots[k] = old[i];
+    }
+    free(old);
+}
+
+// Returns the canonical type equal to the filled-in tmp, which is kept as
+// the canonical one if it is new.
+static type *canonical_type(type *tmp)
+{
+    if ((type_count + 1) * 2 > slot_count)
+        grow_slots();
+    ll key = type_key(tmp);
+    int mask = slot_count - 1;
+    int k = key & mask;
+    while (slots[k].tp != NULL)
+    {
+        if (slots[k].key == key && type_same(slots[k].tp, tmp))
+        {
+            delete (tmp);
+            return slots[k].tp;
+        }
+        k = (k + 1) & mask;
+    }
+    type_shape(tmp);
+    type_layout(tmp);
+    slots[k].key = key;
+    slots[k].tp = tmp;
+    type_count++;
+    return tmp;
+}
+
+void type_release()
+{
+    free(slots);
+    slots = NULL;
+    slot_count = type_count = 0;
+    unit = any = never = NULL;
+    metaint = metafloat = NULL;
+}
+
 static type *new_type(type_class cls)
 {
     type *result = new (type);
@@ -25,7 +251,7 @@ type *new_type_array(type *base, int rank, int *lens)
     result->base = base;
     result->rank = rank;
     result->lens = lens;
-    return result;
+    return canonical_type(result);
 }
 
 type *new_type_func(int argc, symbol **args, type *ret)
@@ -34,7 +260,7 @@ type *new_type_func(int argc, symbol **args, type *ret)
     result->argc = argc;
     result->args = args;
     result->ret = ret;
-    return result;
+    return canonical_type(result);
 }
 
 type *new_type_struct(int memc, symbol **mems)
@@ -42,34 +268,34 @@ type *new_type_struct(int memc, symbol **mems)
     type *result = new_type(TC_STRUCT);
     result->memc = memc;
     result->mems = mems;
-    return result;
+    return canonical_type(result);
 }
 
 type *new_type_type(type *tp)
 {
     type *result = new_type(TC_TYPE);
     result->tp = tp;
-    return result;
+    return canonical_type(result);
 }
 
 type *new_type_unit()
 {
     if (unit == NULL)
-        unit = new_type(TC_UNIT);
+        unit = canonical_type(new_type(TC_UNIT));
     return unit;
 }
 
 type *new_type_any()
 {
     if (any == NULL)
-        any = new_type(TC_ANY);
+        any = canonical_type(new_type(TC_ANY));
     return any;
 }
 
 type *new_type_never()
 {
     if (never == NULL)
-        never = new_type(TC_NEVER);
+        never = canonical_type(new_type(TC_NEVER));
     return never;
 }
 
@@ -82,6 +308,7 @@ type *new_type_meta(metatype_type metatype)
         {
             metaint = new_type(TC_META);
             metaint->metatype = MT_INT;
+            metaint = canonical_type(metaint);
         }
         return metaint;
     case MT_FLOAT:
@@ -89,6 +316,7 @@ type *new_type_meta(metatype_type metatype)
         {
             metafloat = new_type(TC_META);
             metafloat->metatype = MT_FLOAT;
+            metafloat = canonical_type(metafloat);
         }
         return metafloat;
     }
@@ -159,6 +387,11 @@ bool type_full_eq(type *a, type *b, bool strict_arr)
         return true;
     if (a->cls != b->cls)
         return false;
+    // Equal types always have equal shape hashes, unless ANY or NEVER
+    // inside matches anything. Different canonical types may still be equal
+    // here, since names and non-strict array lengths are ignored.
+    if (a->hash != b->hash && !a->wild && !b->wild)
+        return false;
     switch (a->cls)
     {
     case TC_META:
@@ -202,29 +435,9 @@ bool type_full_eq(type *a, type *b, bool strict_arr)
 
 int type_sizeof(type *a)
 {
-    switch (a->cls)
-    {
-    case TC_META:
-        return 4;
-    case TC_ARRAY:
-    {
-        int bsize = type_sizeof(a->base);
-        int factor = 1;
-        for (int i = 0; i < a->rank; i++)
-            factor *= a->lens[i];
-        return bsize * factor;
-    }
-    case TC_STRUCT:
-    {
-        int res = 0;
-        for (int i = 0; i < a->memc; i++)
-        {
-            res += type_sizeof(a->mems[i]->tp);
-        }
-        return res;
-    }
-    }
-    panic("Unexpect type class %d", a->cls);
+    if (a->size < 0)
+        panic("Unexpect type class %d", a->cls);
+    return a->size;
 }
 
 type *type_array_descending(type *t)
@@ -262,19 +475,28 @@ bool type_can_member(type *a)
     return a->cls == TC_STRUCT;
 }
 
-symbol *type_can_membername(type *a, char *name)
+symbol *type_can_membername(type *a, const char *name)
+{
+    return type_member(a, name, NULL);
+}
+
+symbol *type_member(type *a, const char *name, int *offset)
 {
-    symbol *member = NULL;
-    for (int i = 0; i < a->memc; i++)
+    AssertEq(a->cls, TC_STRUCT);
+    int mask = a->mem_slot_count - 1;
+    int k = hash_pointer(name) & mask;
+    while (a->mem_slots[k] != -1)
     {
-        symbol *sym = a->mems[i];
-        if (strcmp(sym->name, name) == 0)
+        symbol *sym = a->mems[a->mem_slots[k]];
+        if (sym->name == name)
         {
-            member = sym;
-            break;
+            if (offset != NULL)
+                *offset = a->offsets[a->mem_slots[k]];
+            return sym;
         }
+        k = (k + 1) & mask;
     }
-    return member;
+    return NULL;
 }
 
 bool type_can_logic(type *a)
@@ -33,7 +33,9 @@ bool type_can_index(type *a);
 
 bool type_can_member(type *a);
 
-symbol *type_can_membername(type *a, char *name);
+symbol *type_can_membername(type *a, const char *name);
+
+symbol *type_member(type *a, const char *name, int *offset);
 
 bool type_can_logic(type *a);
 
@@ -43,4 +45,8 @@ bool type_can_arithmetic2(type *a, type *b);
 
 int type_sizeof(type* a);
 
+// Forgets every canonical type, for when the arena holding them is
+// released. Types made afterwards start a new table.
+void type_release();
+
 #endif
\ No newline at end of file
@@ -0,0 +1,65 @@
+#include <string.h>
+#include "writer.h"
+#include "object.h"
+
+#define WRITER_SIZE (1 << 16)
+
+writer *new_writer(FILE *file)
+{
+    writer *w = new (writer);
+    w->file = file;
+    w->len = 0;
+    w->buf = newvalarr(char, WRITER_SIZE);
+    return w;
+}
+
+void writer_flush(writer *w)
+{
+    if (w->len > 0)
+        fwrite(w->buf, 1, w->len, w->file);
+    w->len = 0;
+}
+
+void writer_str(writer *w, const char *str)
+{
+    int len = strlen(str);
+    if (w->len + len > WRITER_SIZE)
+    {
+        writer_flush(w);
+        if (len > WRITER_SIZE)
+        {
+            fwrite(str, 1, len, w->file);
+            return;
+        }
+    }
+    memcpy(w->buf + w->len, str, len);
+    w->len += len;
+}
+
+void writer_char(writer *w, char c)
+{
+    if (w->len == WRITER_SIZE)
+        writer_flush(w);
+    w->buf[w->len++] = c;
+}
+
+void writer_int(writer *w, int value)
+{
+    // 10 digits and a sign
+    if (w->len + 11 > WRITER_SIZE)
+        writer_flush(w);
+    unsigned int u = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    char digits[10];
+    int count = 0;
+    do
+    {
+        digits[count++] = '0' + u % 10;
+        u /= 10;
+    } while (u != 0);
+    char *p = w->buf + w->len;
+    if (value < 0)
+        *p++ = '-';
+    while (count > 0)
+        *p++ = digits[--count];
+    w->len = p - w->buf;
+}
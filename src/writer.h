@@ -0,0 +1,26 @@
+#ifndef __WRITER_H__
+#define __WRITER_H__
+
+#include <stdio.h>
+#include "common.h"
+
+// Buffered output with hand-rolled formatting, written to the file with
+// fwrite only when the buffer is full or flushed.
+typedef struct
+{
+    FILE *file;
+    int len;
+    char *buf;
+} writer;
+
+writer *new_writer(FILE *file);
+
+void writer_str(writer *w, const char *str);
+
+void writer_char(writer *w, char c);
+
+void writer_int(writer *w, int value);
+
+void writer_flush(writer *w);
+
+#endif
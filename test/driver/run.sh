@@ -0,0 +1,72 @@
+#!/bin/bash
+# Checks that ncc picks its mode and output whatever the order of the
+# other flags.
+
+RED='\033[0;31m'
+NC='\033[0m'
+
+cd $(dirname $0)
+
+RUN=$1
+
+if [ -z $RUN ]
+then
+  echo "Usage: $0 path_to_parser_binary"
+  exit 0
+fi
+
+if ! [ -x $RUN ]
+then
+  echo "Error: file \"$RUN\" is not executable"
+  exit 0
+fi
+
+mkdir -p ./workdir
+
+CODE=0
+
+report_error(){
+  echo -e "${RED}test [$FLAGS]" "$1" "${NC}"
+  CODE=-1
+}
+
+# flags, then ir or asm for what ./workdir/a.out must hold, or fail
+# for a non-zero exit
+while read FLAGS EXPECT; do
+  FLAGS=${FLAGS//,/ }
+  rm -f ./workdir/a.out ./workdir/a.map
+  $RUN ./tests/a.cmm ./workdir/a.out $FLAGS > /dev/null 2> ./workdir/a.err
+  STATUS=$?
+  if [ $EXPECT == fail ]; then
+    if [ $STATUS == 0 ]; then
+      report_error "did not fail"
+    else
+      echo "test [$FLAGS] matched"
+    fi
+    continue
+  fi
+  if [ $STATUS != 0 ]; then
+    report_error "exited with $STATUS"
+    continue
+  fi
+  if [ $EXPECT == ir ] && ! grep -q "^FUNCTION main" ./workdir/a.out; then
+    report_error "did not write IR"
+  elif [ $EXPECT == asm ] && ! grep -q "^main:" ./workdir/a.out; then
+    report_error "did not write asm"
+  elif [[ $FLAGS == *--stats* ]] && ! grep -q "^total" ./workdir/a.err; then
+    report_error "did not print stats"
+  else
+    echo "test [$FLAGS] matched"
+  fi
+done <<END
+--ir ir
+--stats,--ir ir
+--ir,--stats ir
+--no-comments,--ir ir
+--map=./workdir/a.map,--ir ir
+--stats,--no-comments asm
+--map=./workdir/a.map,--stats asm
+--map=./workdir/missing/a.map fail
+END
+
+exit $CODE
@@ -1,6 +1,5 @@
 import json
 from os import system
-from itertools import count
 
 def msg(s):
     print('\033[1m\033[91m' + s + '\033[0m\033[0m');
@@ -11,37 +10,51 @@ def err(data_in, s):
 f_ir   = "./workdir/a.ir";
 f_json = "./workdir/a.json";
 program = "irsim/build/irsim"
-irsim_in  = './workdir/irsim_in'
 irsim_out = './workdir/irsim_out'
 
-for data_in, data_out, ret_val in json.load(open(f_json)):
-    with open(irsim_in, 'w') as to_irsim_w:
-        for i in data_in:
-            to_irsim_w.write(str(i) + '\n')
+# Suppose irsim is compiled by run.sh
+# One irsim run loads the IR once and runs every vector of the json
+tests = json.load(open(f_json))
+system("%s -b %s %s > %s 2>/dev/null"%(program, f_json, f_ir, irsim_out))
 
-    ret = system("%s %s < %s > %s 2>/dev/null"%(program, f_ir , irsim_in , irsim_out))
-    # Suppose irsim is compiled by run.sh
-    if ret != 0:
-        with open(irsim_out, 'r') as from_irsim_r:
-            err(data_in,
-                "runtime error occured when running your IR code\n"
-                + from_irsim_r.read().splitlines()[-1]);
-    with open(irsim_out, 'r') as from_irsim_r:
-        from_irsim_r.readline()
-        # Filter out the first line "load ./workdir/a.ir"
-        try:
-            for idx, expect, user_out in zip(count(1), data_out, from_irsim_r):
-                user_out = int(user_out)
-                if expect != user_out:
-                    err(data_in, "Output mismatch! expected %d, found %d at line %d" % (expect, user_out, idx));
-            else:
-                if "ret with 0, reason 0\n" != from_irsim_r.readline():
-                    err(data_in, "Output mismatch!(you output more than supposed?)")
-                with open("./workdir/count", "r+") as f:
-                    cnt = int(from_irsim_r.readline()) + int(f.read())
-                    f.seek(0)
-                    f.write(str(cnt))
-        except ValueError:
-            err(data_in, "Output mismatch!(you output less than supposed?)")
+with open(irsim_out, 'r') as from_irsim_r:
+    lines = from_irsim_r.read().splitlines()
+# Filter out the first line "load ./workdir/a.ir"
+pos = 1
+total = 0
+for data_in, data_out, ret_val in tests:
+    if pos >= len(lines) or not lines[pos].startswith("vector "):
+        err(data_in, "irsim stopped before running this input\n"
+            + (lines[-1] if lines else ""))
+    pos += 1
+    user_out = []
+    while pos < len(lines) and not lines[pos].startswith("ret with "):
+        user_out.append(lines[pos])
+        pos += 1
+    if pos + 1 >= len(lines):
+        err(data_in, "irsim stopped before running this input\n"
+            + (lines[-1] if lines else ""))
+    ret_line, count_line = lines[pos], lines[pos + 1]
+    pos += 2
+    if ret_line != "ret with 0, reason 0":
+        err(data_in,
+            "runtime error occured when running your IR code\n" + ret_line);
+    try:
+        for idx, expect, out in zip(range(1, len(data_out) + 1), data_out, user_out):
+            out = int(out)
+            if expect != out:
+                err(data_in, "Output mismatch! expected %d, found %d at line %d" % (expect, out, idx));
+    except ValueError:
+        err(data_in, "Output mismatch!(you output less than supposed?)")
+    if len(user_out) > len(data_out):
+        err(data_in, "Output mismatch!(you output more than supposed?)")
+    if len(user_out) < len(data_out):
+        err(data_in, "Output mismatch!(you output less than supposed?)")
+    total += int(count_line)
+
+with open("./workdir/count", "r+") as f:
+    cnt = total + int(f.read())
+    f.seek(0)
+    f.write(str(cnt))
 
 exit(0)
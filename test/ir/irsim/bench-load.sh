@@ -0,0 +1,35 @@
+#!/bin/bash
+# Times loading a large IR file: main returns at once, so the run is
+# nearly all parsing. Pass a second irsim binary to compare against.
+#   ./bench-load.sh [lines] [other-irsim]
+
+cd $(dirname $0)
+make -s
+
+LINES=${1:-1000000}
+IR=build/bench-load.ir
+
+python3 - $LINES > $IR <<'PY'
+import sys
+lines = int(sys.argv[1])
+print("FUNCTION main :\nRETURN #0")
+body = [
+    "PARAM v1", "DEC v2 40", "t1 := #0", "t2 := &v2",
+    "LABEL l{0}a :", "IF t1 >= #10 GOTO l{0}b", "t3 := t1 * #4",
+    "t4 := t2 + t3", "*t4 := v1", "t5 := *t4", "t6 := t5 - #1",
+    "ARG t6", "t7 := CALL f{0}", "WRITE t7", "t1 := t1 + #1",
+    "GOTO l{0}a", "LABEL l{0}b :", "RETURN t1",
+]
+n = 0
+while n < lines:
+    print("FUNCTION f%d :" % n)
+    for l in body:
+        print(l.format(n))
+    n += len(body) + 1
+PY
+
+for bin in build/irsim $2; do
+  echo -n "$bin:"
+  TIMEFORMAT=" %Rs"
+  time $bin $IR > /dev/null
+done
@@ -1,16 +1,23 @@
 #include <cassert>
+#include <cctype>
+#include <charconv>
 #include <climits>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <map>
 #include <memory>
-#include <regex>
 #include <string>
 #include <tuple>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "fmt/printf.h"
 #include "irsim.h"
 
@@ -18,23 +25,54 @@
 // #define DEBUG
 // #define SAFE_POINTER
 
+#if defined(__GNUC__) && !defined(DEBUG) && !defined(NO_THREADED)
+#define THREADED
+#endif
+
 namespace irsim {
 
+#ifdef LOGIR
+/* helper ops carry host pointers as two ints */
+template <class T>
+int ptr_hi(const T *ptr) {
+  return static_cast<int>(
+      reinterpret_cast<uintptr_t>(ptr) >> 32);
+}
+
+template <class T>
+int ptr_lo(const T *ptr) {
+  return static_cast<int>(reinterpret_cast<uintptr_t>(ptr));
+}
+
+template <class T>
+T *lohi_to_ptr(uint32_t lo, uint32_t hi) {
+  uintptr_t ptr = ((uint64_t)hi << 32) | lo;
+  return reinterpret_cast<T *>(ptr);
+}
+#endif
+
 /* clang-format off */
 static std::map<Opc, std::string> opc_to_string{
-    {Opc::abort, "abort"},     {Opc::helper, "helper"},
-    {Opc::lai, "lai"},         {Opc::la, "la"},
-    {Opc::ld, "ld"},           {Opc::st, "st"},
-    {Opc::inc_esp, "inc_esp"}, {Opc::li, "li"},
-    {Opc::mov, "mov"},         {Opc::add, "add"},
-    {Opc::sub, "sub"},         {Opc::mul, "mul"},
-    {Opc::div, "div"},         {Opc::br, "br"},
-    {Opc::cond_br, "cond_br"}, {Opc::lt, "lt"},
-    {Opc::le, "le"},           {Opc::eq, "eq"},
-    {Opc::ge, "ge"},           {Opc::gt, "gt"},
-    {Opc::ne, "ne"},           {Opc::alloca, "alloca"},
-    {Opc::call, "call"},       {Opc::ret, "ret"},
-    {Opc::read, "read"},       {Opc::write, "write"},
+    {Opc::abort, "abort"},          {Opc::tick, "tick"},
+    {Opc::helper, "helper"},        {Opc::arg, "arg"},
+    {Opc::param, "param"},          {Opc::lai, "lai"},
+    {Opc::la, "la"},                {Opc::ld, "ld"},
+    {Opc::st, "st"},                {Opc::li, "li"},
+    {Opc::mov, "mov"},              {Opc::mov2, "mov2"},
+    {Opc::mov_li, "mov_li"},        {Opc::add, "add"},
+    {Opc::sub, "sub"},              {Opc::mul, "mul"},
+    {Opc::div, "div"},              {Opc::add_ri, "add_ri"},
+    {Opc::sub_ri, "sub_ri"},        {Opc::mul_ri, "mul_ri"},
+    {Opc::div_ri, "div_ri"},        {Opc::br, "br"},
+    {Opc::br_lt_rr, "br_lt_rr"},    {Opc::br_le_rr, "br_le_rr"},
+    {Opc::br_eq_rr, "br_eq_rr"},    {Opc::br_ge_rr, "br_ge_rr"},
+    {Opc::br_gt_rr, "br_gt_rr"},    {Opc::br_ne_rr, "br_ne_rr"},
+    {Opc::br_lt_ri, "br_lt_ri"},    {Opc::br_le_ri, "br_le_ri"},
+    {Opc::br_eq_ri, "br_eq_ri"},    {Opc::br_ge_ri, "br_ge_ri"},
+    {Opc::br_gt_ri, "br_gt_ri"},    {Opc::br_ne_ri, "br_ne_ri"},
+    {Opc::alloca, "alloca"},        {Opc::call, "call"},
+    {Opc::ret, "ret"},              {Opc::ret_i, "ret_i"},
+    {Opc::read, "read"},            {Opc::write, "write"},
     {Opc::quit, "quit"},
 };
 /* clang-format on */
@@ -86,38 +124,286 @@ T *SafePointer(T *ptr, size_t right, size_t left = 0) {
 }
 #endif
 
-int Program::run(int *eip) {
+/* Dispatch jumps straight to the next handler (GCC labels as values)
+ * unless THREADED is off, then it is a switch in a loop. Threaded code
+ * holds handler offsets in its opcode slots, resolved on the first run. */
+#ifdef THREADED
+#define OP(opc) L_##opc:
+#define NEXT goto *((char *)&&L_abort + *eip++)
+#else
+#define OP(opc) case Opc::opc:
+#define NEXT break
+#endif
+
+#define COUNT_LINES(n)                                     \
+  do {                                                     \
+    inst_counter += (n);                                   \
+    if (inst_counter >= insts_limit) {                     \
+      exception = Exception::TIMEOUT;                      \
+      return -1;                                           \
+    }                                                      \
+  } while (0)
+
+/* number of ints an op takes, opcode included */
+static size_t op_length(const int *inst) {
+  switch ((Opc)inst[0]) {
+  case Opc::abort:
+  case Opc::if_fault:
+  case Opc::quit: return 1;
+  case Opc::tick:
+  case Opc::arg:
+  case Opc::param:
+  case Opc::alloca:
+  case Opc::read:
+  case Opc::write: return 2;
+  case Opc::lai:
+  case Opc::la:
+  case Opc::ld:
+  case Opc::st:
+  case Opc::li:
+  case Opc::mov:
+  case Opc::br:
+  case Opc::ret:
+  case Opc::ret_i: return 3;
+  case Opc::add:
+  case Opc::sub:
+  case Opc::mul:
+  case Opc::div:
+  case Opc::add_ri:
+  case Opc::sub_ri:
+  case Opc::mul_ri:
+  case Opc::div_ri:
+  case Opc::call: return 4;
+  case Opc::mov2:
+  case Opc::mov_li:
+  case Opc::br_lt_rr:
+  case Opc::br_le_rr:
+  case Opc::br_eq_rr:
+  case Opc::br_ge_rr:
+  case Opc::br_gt_rr:
+  case Opc::br_ne_rr:
+  case Opc::br_lt_ri:
+  case Opc::br_le_ri:
+  case Opc::br_eq_ri:
+  case Opc::br_ge_ri:
+  case Opc::br_gt_ri:
+  case Opc::br_ne_ri: return 5;
+  case Opc::helper: return 4 + inst[3];
+  case Opc::NR_OPCS: break;
+  }
+  return 0;
+}
+
+/* a saved program is this header and then its code, stale images
+ * are refused rather than run with shifted opcodes */
+struct ImageHeader {
+  char magic[4];
+  int version;
+  int nr_opcs;
+  int entry;
+  int start, start_call;
+  int code_size;
+};
+
+static constexpr char image_magic[4] = {'I', 'R', 'B', '\0'};
+static constexpr int image_version = 1;
+
+Program::~Program() {
+  if (image) munmap(image, image_size);
+}
+
+bool Program::is_image(const char *path) {
+  char magic[sizeof(image_magic)] = {};
+  std::ifstream ifs(path, std::ios::binary);
+  ifs.read(magic, sizeof(magic));
+  return ifs.good() &&
+         memcmp(magic, image_magic, sizeof(magic)) == 0;
+}
+
+bool Program::save(const char *path) const {
+#ifdef LOGIR
+  /* helper ops hold host pointers */
+  return false;
+#endif
+  /* threaded code holds handler offsets of this very binary */
+  if (threaded) return false;
+
+  ImageHeader header{};
+  memcpy(header.magic, image_magic, sizeof(image_magic));
+  header.version = image_version;
+  header.nr_opcs = (int)Opc::NR_OPCS;
+  header.entry = entry;
+  header.start = start;
+  header.start_call = start_call;
+  header.code_size = text.size();
+
+  std::ofstream ofs(path, std::ios::binary);
+  ofs.write((const char *)&header, sizeof(header));
+  ofs.write((const char *)text.data(), text.size() * sizeof(int));
+  return ofs.good();
+}
+
+std::unique_ptr<Program> Program::load(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return nullptr;
+
+  struct stat st;
+  void *image = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ImageHeader)) {
+    /* private and writable, the code is threaded in place */
+    image = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (image == MAP_FAILED) return nullptr;
+
+  auto prog = std::make_unique<Program>();
+  prog->image = image;
+  prog->image_size = st.st_size;
+
+  auto *header = (const ImageHeader *)image;
+  if (memcmp(header->magic, image_magic, sizeof(image_magic)) ||
+      header->version != image_version ||
+      header->nr_opcs != (int)Opc::NR_OPCS || header->code_size < 0 ||
+      sizeof(ImageHeader) + header->code_size * sizeof(int) !=
+          (size_t)st.st_size) {
+    return nullptr;
+  }
+
+  prog->code = (int *)((char *)image + sizeof(ImageHeader));
+  prog->code_size = header->code_size;
+
+  /* every op must be known and fit, the entry, the startup code and
+   * every jump target must sit on op boundaries; helper ops hold host
+   * pointers and are never saved */
+  bool entry_ok = false, start_ok = false, call_ok = false;
+  std::vector<bool> boundary(prog->code_size);
+  std::vector<size_t> slots;
+  for (size_t i = 0; i < prog->code_size;) {
+    int opc = prog->code[i];
+    if (opc < 0 || opc >= (int)Opc::NR_OPCS || opc == (int)Opc::helper)
+      return nullptr;
+    size_t len = op_length(&prog->code[i]);
+    if (len == 0 || i + len > prog->code_size) return nullptr;
+    boundary[i] = true;
+    entry_ok |= (int)i == header->entry;
+    start_ok |= (int)i == header->start;
+    call_ok |= opc == (int)Opc::call && (int)i + 2 == header->start_call;
+    /* the slot holding the offset, as gen_br, gen_br_cmp and gen_call
+     * place it */
+    if (opc == (int)Opc::br) {
+      slots.push_back(i + 1);
+    } else if (opc == (int)Opc::call) {
+      slots.push_back(i + 2);
+    } else if (opc >= (int)Opc::br_lt_rr && opc <= (int)Opc::br_ne_ri) {
+      slots.push_back(i + 3);
+    }
+    i += len;
+  }
+  if (!start_ok || !call_ok || (header->entry >= 0 && !entry_ok))
+    return nullptr;
+  for (size_t slot : slots) {
+    long long target = (long long)slot + prog->code[slot];
+    if (target < 0 || target >= (long long)prog->code_size ||
+        !boundary[target])
+      return nullptr;
+  }
+
+  prog->entry = header->entry;
+  prog->start = header->start;
+  prog->start_call = header->start_call;
+  return prog;
+}
+
+int Program::run(int entry) {
   std::vector<int *> frames;
   std::vector<int> args;
 
-  auto ret = 2, inc = 3;
+#ifdef THREADED
   /* clang-format off */
-  int _start[] = {
-      (int)Opc::alloca, 4,
-      (int)Opc::li, ret, 0,
-      (int)Opc::li, inc, inc,
-      (int)Opc::inc_esp, inc,
-      (int)Opc::call, ptr_lo(eip), ptr_hi(eip),
-      (int)Opc::quit, 0,
+  const int handlers[] = {
+      (int)((char *)&&L_abort - (char *)&&L_abort),
+      (int)((char *)&&L_if_fault - (char *)&&L_abort),
+      (int)((char *)&&L_tick - (char *)&&L_abort),
+      (int)((char *)&&L_helper - (char *)&&L_abort),
+      (int)((char *)&&L_arg - (char *)&&L_abort),
+      (int)((char *)&&L_param - (char *)&&L_abort),
+      (int)((char *)&&L_lai - (char *)&&L_abort),
+      (int)((char *)&&L_la - (char *)&&L_abort),
+      (int)((char *)&&L_ld - (char *)&&L_abort),
+      (int)((char *)&&L_st - (char *)&&L_abort),
+      (int)((char *)&&L_li - (char *)&&L_abort),
+      (int)((char *)&&L_mov - (char *)&&L_abort),
+      (int)((char *)&&L_mov2 - (char *)&&L_abort),
+      (int)((char *)&&L_mov_li - (char *)&&L_abort),
+      (int)((char *)&&L_add - (char *)&&L_abort),
+      (int)((char *)&&L_sub - (char *)&&L_abort),
+      (int)((char *)&&L_mul - (char *)&&L_abort),
+      (int)((char *)&&L_div - (char *)&&L_abort),
+      (int)((char *)&&L_add_ri - (char *)&&L_abort),
+      (int)((char *)&&L_sub_ri - (char *)&&L_abort),
+      (int)((char *)&&L_mul_ri - (char *)&&L_abort),
+      (int)((char *)&&L_div_ri - (char *)&&L_abort),
+      (int)((char *)&&L_br - (char *)&&L_abort),
+      (int)((char *)&&L_br_lt_rr - (char *)&&L_abort),
+      (int)((char *)&&L_br_le_rr - (char *)&&L_abort),
+      (int)((char *)&&L_br_eq_rr - (char *)&&L_abort),
+      (int)((char *)&&L_br_ge_rr - (char *)&&L_abort),
+      (int)((char *)&&L_br_gt_rr - (char *)&&L_abort),
+      (int)((char *)&&L_br_ne_rr - (char *)&&L_abort),
+      (int)((char *)&&L_br_lt_ri - (char *)&&L_abort),
+      (int)((char *)&&L_br_le_ri - (char *)&&L_abort),
+      (int)((char *)&&L_br_eq_ri - (char *)&&L_abort),
+      (int)((char *)&&L_br_ge_ri - (char *)&&L_abort),
+      (int)((char *)&&L_br_gt_ri - (char *)&&L_abort),
+      (int)((char *)&&L_br_ne_ri - (char *)&&L_abort),
+      (int)((char *)&&L_alloca - (char *)&&L_abort),
+      (int)((char *)&&L_call - (char *)&&L_abort),
+      (int)((char *)&&L_ret - (char *)&&L_abort),
+      (int)((char *)&&L_ret_i - (char *)&&L_abort),
+      (int)((char *)&&L_read - (char *)&&L_abort),
+      (int)((char *)&&L_write - (char *)&&L_abort),
+      (int)((char *)&&L_quit - (char *)&&L_abort),
   };
   /* clang-format on */
+  static_assert(sizeof(handlers) / sizeof(handlers[0]) ==
+                    (size_t)Opc::quit + 1,
+      "a handler for every opcode");
+
+#endif
 
-  eip = &_start[0];
+  if (!image) {
+    code = text.data();
+    code_size = text.size();
+  }
+
+#ifdef THREADED
+  if (!threaded) {
+    for (size_t i = 0; i < code_size;) {
+      size_t len = op_length(&code[i]);
+      code[i] = handlers[code[i]];
+      i += len;
+    }
+    threaded = true;
+  }
+#endif
+
+  code[start_call] = rel(start_call, entry);
+  int *eip = &code[start];
   auto esp = SafePointer<int>(&stack[0], stack.size());
 
+  int from, to;
+  int lhs, rhs;
+  int constant;
+
+#ifdef THREADED
+  NEXT;
+#else
   while (true) {
 #ifdef DEBUG
     auto oldeip = eip;
 #endif
-    if (eip == nullptr) {
-      exception = Exception::IF;
-      return -1;
-    }
-
     int opc = *eip++;
-    int from, to;
-    int lhs, rhs;
-    int constant;
 
 #ifdef DEBUG
     fmt::printf("stack:\n");
@@ -138,14 +424,19 @@ int Program::run(int *eip) {
 #endif
 
     switch ((Opc)opc) {
-    case Opc::abort:
+#endif
+    OP(if_fault)
+      exception = Exception::IF;
+      return -1;
+    OP(abort)
       fmt::printf("unexpected instruction\n");
       exception = Exception::ABORT;
 #ifdef DEBUG
       fmt::printf("%p: abort\n", fmt::ptr(oldeip));
 #endif
       return -1;
-    case Opc::helper: {
+    OP(helper) {
+#ifdef LOGIR
       int ptrlo = *eip++;
       int ptrhi = *eip++;
       int nr_args = *eip++;
@@ -157,21 +448,26 @@ int Program::run(int *eip) {
       fmt::printf(
           "%p: helper %p\n", fmt::ptr(oldeip), (void *)f);
 #endif
-    } break;
-    case Opc::arg: to = *eip++; args.push_back(esp[to]);
+#else
+      /* only LOGIR builds emit helpers */
+      exception = Exception::INVOP;
+      return -1;
+#endif
+    } NEXT;
+    OP(arg) to = *eip++; args.push_back(esp[to]);
 #ifdef DEBUG
       fmt::printf("%p: arg %d\n", fmt::ptr(oldeip), to);
 #endif
-      break;
-    case Opc::param:
+      NEXT;
+    OP(param)
       to = *eip++;
       esp[to] = args.back();
       args.pop_back();
 #ifdef DEBUG
       fmt::printf("%p: param %d\n", fmt::ptr(oldeip), to);
 #endif
-      break;
-    case Opc::lai: {
+      NEXT;
+    OP(lai) {
       to = *eip++;
       from = *eip++;
       esp[to] = ((int)(esp - &stack[0]) + from) * 4;
@@ -179,8 +475,8 @@ int Program::run(int *eip) {
       fmt::printf(
           "%p: lai %d, %d\n", fmt::ptr(oldeip), to, from);
 #endif
-    } break;
-    case Opc::la: {
+    } NEXT;
+    OP(la) {
       to = *eip++;
       from = esp[*eip++];
       esp[to] = ((int)(esp - &stack[0]) + from) * 4;
@@ -188,8 +484,8 @@ int Program::run(int *eip) {
       fmt::printf("%p: la %d, (%d)=%d\n", fmt::ptr(oldeip),
           to, eip[-1], from);
 #endif
-    } break;
-    case Opc::ld: {
+    } NEXT;
+    OP(ld) {
       to = *eip++;
       from = *eip++;
       /* esp[to] = stack[esp[from]] */
@@ -204,8 +500,8 @@ int Program::run(int *eip) {
       }
       memcpy(&esp[to], (char *)&stack[0] + esp[from],
           sizeof(int));
-    } break;
-    case Opc::st: {
+    } NEXT;
+    OP(st) {
       to = *eip++;
       from = *eip++;
       /* stack[esp[to]] = esp[from] */
@@ -220,8 +516,8 @@ int Program::run(int *eip) {
       fmt::printf("%p: st (%d)=%d, %d\n", fmt::ptr(oldeip),
           to, esp[to], from);
 #endif
-    } break;
-    case Opc::li: {
+    } NEXT;
+    OP(li) {
       to = *eip++;
       lhs = *eip++;
       esp[to] = lhs;
@@ -233,8 +529,8 @@ int Program::run(int *eip) {
         fmt::printf(
             "%p: li %d %d\n", fmt::ptr(oldeip), to, lhs);
 #endif
-    } break;
-    case Opc::mov:
+    } NEXT;
+    OP(mov)
       /* esp[*eip++] = esp[*eip++]; // WARNING: undefined
        * behavior */
       to = *eip++;
@@ -244,8 +540,18 @@ int Program::run(int *eip) {
           "%p: mov %d %d\n", fmt::ptr(oldeip), to, lhs);
 #endif
       esp[to] = esp[lhs];
-      break;
-    case Opc::add:
+      NEXT;
+    OP(mov2)
+      esp[eip[0]] = esp[eip[1]];
+      esp[eip[2]] = esp[eip[3]];
+      eip += 4;
+      NEXT;
+    OP(mov_li)
+      esp[eip[0]] = esp[eip[1]];
+      esp[eip[2]] = eip[3];
+      eip += 4;
+      NEXT;
+    OP(add)
       to = *eip++;
       lhs = *eip++;
       rhs = *eip++;
@@ -254,8 +560,8 @@ int Program::run(int *eip) {
       fmt::printf("%p: add %d, %d, %d\n", fmt::ptr(oldeip),
           to, lhs, rhs);
 #endif
-      break;
-    case Opc::sub:
+      NEXT;
+    OP(sub)
       to = *eip++;
       lhs = *eip++;
       rhs = *eip++;
@@ -264,8 +570,8 @@ int Program::run(int *eip) {
       fmt::printf("%p: sub %d, %d, %d\n", fmt::ptr(oldeip),
           to, lhs, rhs);
 #endif
-      break;
-    case Opc::mul:
+      NEXT;
+    OP(mul)
       to = *eip++;
       lhs = *eip++;
       rhs = *eip++;
@@ -274,8 +580,8 @@ int Program::run(int *eip) {
       fmt::printf("%p: mul %d, %d, %d\n", fmt::ptr(oldeip),
           to, lhs, rhs);
 #endif
-      break;
-    case Opc::div:
+      NEXT;
+    OP(div)
       to = *eip++;
       lhs = *eip++;
       rhs = *eip++;
@@ -289,104 +595,74 @@ int Program::run(int *eip) {
       fmt::printf("%p: div %d, %d, %d\n", fmt::ptr(oldeip),
           to, lhs, rhs);
 #endif
-      break;
-    case Opc::br: {
-      uint64_t ptrlo = *eip++;
-      uint64_t ptrhi = *eip++;
+      NEXT;
+    OP(add_ri)
+      esp[eip[0]] = esp[eip[1]] + eip[2];
+      eip += 3;
+      NEXT;
+    OP(sub_ri)
+      esp[eip[0]] = esp[eip[1]] - eip[2];
+      eip += 3;
+      NEXT;
+    OP(mul_ri)
+      esp[eip[0]] = esp[eip[1]] * eip[2];
+      eip += 3;
+      NEXT;
+    OP(div_ri) /* never by #0, that one goes through div */
+      esp[eip[0]] = esp[eip[1]] / eip[2];
+      eip += 3;
+      NEXT;
+    OP(br) {
 #ifdef DEBUG
       fmt::printf("%p: br %p\n", fmt::ptr(oldeip),
-          lohi_to_ptr<void>(ptrlo, ptrhi));
-#endif
-      eip = lohi_to_ptr<int>(ptrlo, ptrhi);
-    } break;
-    case Opc::cond_br: {
-      int cond = esp[*eip++];
-      uint64_t ptrlo = *eip++;
-      uint64_t ptrhi = *eip++;
-#ifdef DEBUG
-      fmt::printf("%p: cond %d br %p\n", fmt::ptr(oldeip),
-          cond, lohi_to_ptr<void>(ptrlo, ptrhi));
-#endif
-      if (cond) { eip = lohi_to_ptr<int>(ptrlo, ptrhi); }
-    } break;
-    case Opc::lt:
-      to = *eip++;
-      lhs = *eip++;
-      rhs = *eip++;
-      esp[to] = esp[lhs] < esp[rhs];
-#ifdef DEBUG
-      fmt::printf("%p: lt %d, %d, %d\n", fmt::ptr(oldeip),
-          to, lhs, rhs);
-#endif
-      break;
-    case Opc::le:
-      to = *eip++;
-      lhs = *eip++;
-      rhs = *eip++;
-      esp[to] = esp[lhs] <= esp[rhs];
-#ifdef DEBUG
-      fmt::printf("%p: le %d, %d, %d\n", fmt::ptr(oldeip),
-          to, lhs, rhs);
-#endif
-      break;
-    case Opc::eq:
-      to = *eip++;
-      lhs = *eip++;
-      rhs = *eip++;
-      esp[to] = esp[lhs] == esp[rhs];
-#ifdef DEBUG
-      fmt::printf("%p: eq %d, %d, %d\n", fmt::ptr(oldeip),
-          to, lhs, rhs);
-#endif
-      break;
-    case Opc::ge:
-      to = *eip++;
-      lhs = *eip++;
-      rhs = *eip++;
-      esp[to] = esp[lhs] >= esp[rhs];
-#ifdef DEBUG
-      fmt::printf("%p: ge %d, %d, %d\n", fmt::ptr(oldeip),
-          to, lhs, rhs);
-#endif
-      break;
-    case Opc::gt:
-      to = *eip++;
-      lhs = *eip++;
-      rhs = *eip++;
-      esp[to] = esp[lhs] > esp[rhs];
-#ifdef DEBUG
-      fmt::printf("%p: gt %d, %d, %d\n", fmt::ptr(oldeip),
-          to, lhs, rhs);
-#endif
-      break;
-    case Opc::ne:
-      to = *eip++;
-      lhs = *eip++;
-      rhs = *eip++;
-      esp[to] = esp[lhs] != esp[rhs];
-#ifdef DEBUG
-      fmt::printf("%p: ne %d, %d, %d\n", fmt::ptr(oldeip),
-          to, lhs, rhs);
-#endif
-      break;
-    case Opc::inc_esp: constant = *eip++;
-#ifdef DEBUG
-      fmt::printf("%p: inc_esp %d\n", fmt::ptr(oldeip), to);
+          fmt::ptr(eip + eip[0]));
 #endif
+      COUNT_LINES(eip[1]);
+      eip += eip[0];
+    } NEXT;
+/* br_<relop> lhs, rhs, target, lines */
+#define BR_CMP(name, op, rhs_value)                        \
+  OP(name) {                                               \
+    COUNT_LINES(eip[3]);                                   \
+    if (esp[eip[0]] op(rhs_value)) {                       \
+      eip += 2 + eip[2];                                   \
+    } else {                                               \
+      eip += 4;                                            \
+    }                                                      \
+  }                                                        \
+  NEXT;
+    BR_CMP(br_lt_rr, <, esp[eip[1]])
+    BR_CMP(br_le_rr, <=, esp[eip[1]])
+    BR_CMP(br_eq_rr, ==, esp[eip[1]])
+    BR_CMP(br_ge_rr, >=, esp[eip[1]])
+    BR_CMP(br_gt_rr, >, esp[eip[1]])
+    BR_CMP(br_ne_rr, !=, esp[eip[1]])
+    BR_CMP(br_lt_ri, <, eip[1])
+    BR_CMP(br_le_ri, <=, eip[1])
+    BR_CMP(br_eq_ri, ==, eip[1])
+    BR_CMP(br_ge_ri, >=, eip[1])
+    BR_CMP(br_gt_ri, >, eip[1])
+    BR_CMP(br_ne_ri, !=, eip[1])
+#undef BR_CMP
+    OP(call) {
+      constant = eip[0];
+      COUNT_LINES(eip[2]);
+      int *target = eip + 1 + eip[1];
+      /* push a copy, a reference to eip itself would keep it out
+       * of a register for the whole loop */
+      int *back = eip + 3;
+      frames.push_back(back);
+      esp[constant] = constant;
       esp += constant;
-      break;
-    case Opc::call: {
-      int ptrlo = *eip++;
-      int ptrhi = *eip++;
-      int *target = lohi_to_ptr<int>(ptrlo, ptrhi);
-      frames.push_back(eip);
       eip = target;
 #ifdef DEBUG
       fmt::printf(
           "%p: call %p\n", fmt::ptr(oldeip), fmt::ptr(eip));
 #endif
-    } break;
-    case Opc::ret: {
+    } NEXT;
+    OP(ret) { /* esp[-1] is the caller's slot for the result */
+      COUNT_LINES(eip[1]);
+      esp[-1] = esp[eip[0]];
       esp -= esp[0];
       assert(frames.size());
       eip = frames.back();
@@ -395,8 +671,20 @@ int Program::run(int *eip) {
       fmt::printf(
           "%p: ret %p\n", fmt::ptr(oldeip), fmt::ptr(eip));
 #endif
-    } break;
-    case Opc::alloca: {
+    } NEXT;
+    OP(ret_i) {
+      COUNT_LINES(eip[1]);
+      esp[-1] = eip[0];
+      esp -= esp[0];
+      assert(frames.size());
+      eip = frames.back();
+      frames.pop_back();
+#ifdef DEBUG
+      fmt::printf(
+          "%p: ret %p\n", fmt::ptr(oldeip), fmt::ptr(eip));
+#endif
+    } NEXT;
+    OP(alloca) {
       int size = *eip++;
 #ifdef DEBUG
       fmt::printf(
@@ -417,324 +705,394 @@ int Program::run(int *eip) {
           return -1;
         }
       }
-    } break;
-    case Opc::read:
+    } NEXT;
+    OP(read)
       to = *eip++;
       esp[to] = io.read();
       if(io.eof()) {
         exception = Exception::EOF_OCCUR;
         return -1;
       }
-      break;
-    case Opc::write: to = *eip++; io.write(esp[to]);
+      NEXT;
+    OP(write) to = *eip++; io.write(esp[to]);
 #ifdef DEBUG
       fmt::printf("%p: write %d\n", fmt::ptr(oldeip), to);
 #endif
-      break;
-    case Opc::quit: return 0;
-    case Opc::inst_begin:
-      inst_counter++;
-      if (inst_counter >= insts_limit) {
-        exception = Exception::TIMEOUT;
-        return -1;
-      }
-      break;
+      NEXT;
+    OP(quit) return 0;
+    OP(tick)
+      COUNT_LINES(*eip++);
+      NEXT;
+#ifndef THREADED
     default:
       fmt::printf("unexpected opc %d\n", opc);
       exception = Exception::INVOP;
       return -1;
     }
   }
+#endif
   return 0;
 }
 
+#undef OP
+#undef NEXT
+#undef COUNT_LINES
+
 /* clang-format off */
-std::map<Stmt, bool (Compiler::*)(Program *, const std::string &)>
-Compiler::handlers{
-    {Stmt::label, &Compiler::handle_label},
-    {Stmt::func, &Compiler::handle_func},
-    {Stmt::assign, &Compiler::handle_assign},
-    {Stmt::add, &Compiler::handle_arith},
-    {Stmt::sub, &Compiler::handle_arith},
-    {Stmt::mul, &Compiler::handle_arith},
-    {Stmt::div, &Compiler::handle_arith},
-    {Stmt::takeaddr, &Compiler::handle_takeaddr},
-    {Stmt::deref, &Compiler::handle_deref},
-    {Stmt::deref_assign, &Compiler::handle_deref_assign},
-    {Stmt::goto_, &Compiler::handle_goto_},
-    {Stmt::branch, &Compiler::handle_branch},
-    {Stmt::ret, &Compiler::handle_ret},
-    {Stmt::dec, &Compiler::handle_dec},
-    {Stmt::arg, &Compiler::handle_arg},
-    {Stmt::call, &Compiler::handle_call},
-    {Stmt::param, &Compiler::handle_param},
-    {Stmt::read, &Compiler::handle_read},
-    {Stmt::write, &Compiler::handle_write},
+std::map<std::string_view, Compiler::Handler> Compiler::keywords{
+    {"LABEL", &Compiler::handle_label},
+    {"FUNCTION", &Compiler::handle_func},
+    {"GOTO", &Compiler::handle_goto_},
+    {"IF", &Compiler::handle_branch},
+    {"RETURN", &Compiler::handle_ret},
+    {"DEC", &Compiler::handle_dec},
+    {"ARG", &Compiler::handle_arg},
+    {"PARAM", &Compiler::handle_param},
+    {"READ", &Compiler::handle_read},
+    {"WRITE", &Compiler::handle_write},
 };
 /* clang-format on */
 
+static bool is_word_char(char c) {
+  return isalnum((unsigned char)c) || c == '_';
+}
+
+/* splits a line into words, #immediates and punctuation, fails on
+ * characters no statement contains */
+static bool tokenize(const std::string &line, Tokens &toks) {
+  static const std::string_view puncts[] = {
+      ":=", "<=", ">=", "==", "!=", ":", "<", ">", "+", "-",
+      "*", "/", "&",
+  };
+
+  toks.clear();
+  std::string_view rest(line);
+  while (true) {
+    while (!rest.empty() && isspace((unsigned char)rest[0]))
+      rest.remove_prefix(1);
+    if (rest.empty()) return true;
+
+    size_t n = 0;
+    Token::Kind kind = Token::word;
+    if (is_word_char(rest[0])) {
+      while (n < rest.size() && is_word_char(rest[n])) n++;
+    } else if (rest[0] == '#') {
+      kind = Token::imm;
+      n = 1;
+      if (n < rest.size() && (rest[n] == '+' || rest[n] == '-'))
+        n++;
+      size_t digits = n;
+      while (n < rest.size() && isdigit((unsigned char)rest[n]))
+        n++;
+      if (n == digits) return false;
+    } else {
+      kind = Token::punct;
+      for (auto p : puncts) {
+        if (rest.substr(0, p.size()) == p) {
+          n = p.size();
+          break;
+        }
+      }
+      if (n == 0) return false;
+    }
+    toks.push_back(Token{kind, rest.substr(0, n)});
+    rest.remove_prefix(n);
+  }
+}
+
+static bool is_word(const Tokens &toks, size_t i) {
+  return i < toks.size() && toks[i].kind == Token::word;
+}
+
+static bool is_punct(
+    const Tokens &toks, size_t i, std::string_view p) {
+  return i < toks.size() && toks[i].kind == Token::punct &&
+         toks[i].text == p;
+}
+
+/* reads the operand at toks[i] and moves i past it */
+static bool parse_operand(
+    const Tokens &toks, size_t &i, Operand &op) {
+  if (i >= toks.size()) return false;
+  auto &tok = toks[i];
+  if (tok.kind == Token::imm) {
+    op = Operand{'#', tok.text.substr(1)};
+    i++;
+    return true;
+  }
+  if (tok.kind == Token::word) {
+    op = Operand{0, tok.text};
+    i++;
+    return true;
+  }
+  if ((tok.text == "&" || tok.text == "*") && is_word(toks, i + 1)) {
+    op = Operand{tok.text[0], toks[i + 1].text};
+    i += 2;
+    return true;
+  }
+  return false;
+}
+
+/* an operand that is the whole rest of the line from toks[i] */
+static bool parse_last_operand(
+    const Tokens &toks, size_t i, Operand &op) {
+  return parse_operand(toks, i, op) && i == toks.size();
+}
+
+int Compiler::imm_value(const Operand &op) {
+  auto text = op.text;
+  if (text[0] == '+') text.remove_prefix(1);
+  long long value = 0;
+  std::from_chars(text.data(), text.data() + text.size(), value);
+  return static_cast<int>(value);
+}
+
 int Compiler::primary_exp(
-    Program *prog, const std::string &tok, int to) {
-  if (tok[0] == '#') {
+    Program *prog, const Operand &op, int to) {
+  if (op.prefix == '#') {
     if (to == INT_MAX) to = newTemp();
-    prog->gen_inst(Opc::li, to, std::stoll(&tok[1]));
+    prog->gen_li(to, imm_value(op));
     return to;
-  } else if (tok[0] == '&') {
-    auto var = getVar(&tok[1]);
+  } else if (op.prefix == '&') {
+    auto var = getVar(op.text);
     if (to == INT_MAX) to = newTemp();
     prog->gen_inst(Opc::lai, to, var);
     return to;
-  } else if (tok[0] == '*') {
-    auto var = getVar(&tok[1]);
+  } else if (op.prefix == '*') {
+    auto var = getVar(op.text);
     if (to == INT_MAX) to = newTemp();
     prog->gen_inst(Opc::ld, to, var);
     return to;
   } else {
     if (to != INT_MAX) {
-      prog->gen_inst(Opc::mov, to, getVar(tok));
+      prog->gen_mov(to, getVar(op.text));
       return to;
     } else {
-      return getVar(tok);
+      return getVar(op.text);
     }
   }
 }
 
-/* stmt label */
-bool Compiler::handle_label(
-    Program *prog, const std::string &line) {
-  static std::regex pat(R"(^\s*LABEL\s+(\w+)\s*:\s*$)");
-  auto it = std::sregex_token_iterator(
-      line.begin(), line.end(), pat, m1);
+/* dispatches on the ':=' shape, then on the first keyword */
+bool Compiler::compile_line(Program *prog, const Tokens &toks) {
+  if (is_punct(toks, 1, ":=")) {
+    if (!is_word(toks, 0)) return false;
+    if (toks.size() == 4 && toks[2].text == "CALL" &&
+        is_word(toks, 3))
+      return handle_call(prog, toks);
+    return handle_assign(prog, toks);
+  }
+  if (is_punct(toks, 0, "*")) return handle_deref_assign(prog, toks);
+  if (!is_word(toks, 0)) return false;
 
-  if (it == std::sregex_token_iterator()) return false;
+  auto it = keywords.find(toks[0].text);
+  if (it == keywords.end()) return false;
+  return (this->*(it->second))(prog, toks);
+}
 
-  auto label = *it++;
-  auto label_ptr = prog->get_textptr();
-  labels[label] = label_ptr;
+/* stmt label */
+bool Compiler::handle_label(Program *prog, const Tokens &toks) {
+  if (toks.size() != 3 || !is_word(toks, 1) ||
+      !is_punct(toks, 2, ":"))
+    return false;
+
+  flushLines(prog);
+  auto label = toks[1].text;
+  auto label_pos = prog->place_label();
+  labels[std::string(label)] = label_pos;
 #ifdef DEBUG
-  fmt::printf("add label %s, %p\n", label.str(),
-      fmt::ptr(label_ptr));
+  fmt::printf("add label %s, %d\n", std::string(label), label_pos);
 #endif
-  for (auto *ptr : backfill_labels[label]) {
-    ptr[0] = ptr_lo(label_ptr);
-    ptr[1] = ptr_hi(label_ptr);
+  auto it = backfill_labels.find(label);
+  if (it != backfill_labels.end()) {
+    for (auto slot : it->second) prog->set_target(slot, label_pos);
+    backfill_labels.erase(it);
   }
-  backfill_labels.erase(label);
   return true;
 }
 
 /* stmt func */
-bool Compiler::handle_func(
-    Program *prog, const std::string &line) {
-  static std::regex pat(R"(^\s*FUNCTION\s+(\w+)\s*:\s*$)");
-  auto it = std::sregex_token_iterator(
-      line.begin(), line.end(), pat, m1);
-  if (it == std::sregex_token_iterator()) return false;
+bool Compiler::handle_func(Program *prog, const Tokens &toks) {
+  if (toks.size() != 3 || !is_word(toks, 1) ||
+      !is_punct(toks, 2, ":"))
+    return false;
 
-  auto f = *it++;
+  auto f = toks[1].text;
 
+  flushLines(prog);
   prog->gen_inst(
       Opc::abort); // last function should manually ret
-  funcs[f] = prog->get_textptr();
+  funcs[std::string(f)] = prog->place_label();
 
-  if (prog->curf[0] == (int)Opc::alloca) {
-    prog->curf[1] = stack_size + 1;
+  if (prog->curf >= 0) {
+    prog->text[prog->curf + 1] = stack_size + 1;
     clear_env();
   }
   prog->curf = prog->gen_inst(Opc::alloca, 0);
+  temps.clear();
   return true;
 }
 
-bool Compiler::handle_assign(
-    Program *prog, const std::string &line) {
-  static std::regex pat(
-      R"(^\s*(\w+)\s*:=\s*(#[\+\-]?\d+|[&\*]?\w+)\s*$)");
-  auto it = std::sregex_token_iterator(
-      line.begin(), line.end(), pat, m2);
-  if (it == std::sregex_token_iterator()) return false;
-
-  auto x = getVar(*it++);
-  primary_exp(prog, *it++, x);
-  return true;
-}
-
-bool Compiler::handle_arith(
-    Program *prog, const std::string &line) {
-  static std::regex pat(
-      R"(^\s*(\w+)\s*:=\s*(#[\+\-]?\d+|[&\*]?\w+)\s*(\+|\-|\*|\/)\s*(#[\+\-]?\d+|[&\*]?\w+)\s*$)");
-
-  static std::map<std::string, Opc> m{
-      {"+", Opc::add},
-      {"-", Opc::sub},
-      {"*", Opc::mul},
-      {"/", Opc::div},
+/* x := y, x := y op z */
+bool Compiler::handle_assign(Program *prog, const Tokens &toks) {
+  /* op, its _ri form and whether it commutes */
+  static std::map<std::string_view, std::tuple<Opc, Opc, bool>> m{
+      {"+", {Opc::add, Opc::add_ri, true}},
+      {"-", {Opc::sub, Opc::sub_ri, false}},
+      {"*", {Opc::mul, Opc::mul_ri, true}},
+      {"/", {Opc::div, Opc::div_ri, false}},
   };
 
-  auto it = std::sregex_token_iterator(
-      line.begin(), line.end(), pat, m4);
-  if (it == std::sregex_token_iterator()) return false;
+  size_t i = 2;
+  Operand lhs, rhs;
+  if (!parse_operand(toks, i, lhs)) return false;
 
-  auto x = getVar(*it++);
-  auto y = primary_exp(prog, *it++);
-  auto op = *it++;
-  auto z = primary_exp(prog, *it++);
+  if (i == toks.size()) {
+    primary_exp(prog, lhs, getVar(toks[0].text));
+    return true;
+  }
 
-  prog->gen_inst(m[op], x, y, z);
-  return true;
-}
+  if (toks[i].kind != Token::punct) return false;
+  auto op = m.find(toks[i].text);
+  if (op == m.end() || !parse_last_operand(toks, i + 1, rhs))
+    return false;
 
-bool Compiler::handle_takeaddr(
-    Program *prog, const std::string &line) {
-  static std::regex pat(
-      R"(^\s*(\w+)\s*:=\s*&\s*(\w+)\s*$)");
-  /* stmt assign */
-  auto it = std::sregex_token_iterator(
-      line.begin(), line.end(), pat, m2);
-  if (it == std::sregex_token_iterator()) return false;
-  auto x = *it++;
-  auto y = *it++;
-  prog->gen_inst(Opc::li, getVar(x), getVar(y));
-  return true;
-}
+  auto [opc, opc_ri, commutes] = op->second;
+  if (lhs.prefix == '#' && rhs.prefix != '#' && commutes)
+    std::swap(lhs, rhs);
+
+  auto x = getVar(toks[0].text);
+  auto y = primary_exp(prog, lhs);
+  if (rhs.prefix == '#' && (opc != Opc::div || imm_value(rhs))) {
+    prog->gen_inst(opc_ri, x, y, imm_value(rhs));
+    return true;
+  }
+  auto z = primary_exp(prog, rhs);
 
-bool Compiler::handle_deref(
-    Program *prog, const std::string &line) {
-  static std::regex pat(
-      R"(^\s*(\w+)\s*:=\s*\*\s*(\w+)\s*$)");
-  /* stmt assign */
-  auto it = std::sregex_token_iterator(
-      line.begin(), line.end(), pat, m2);
-  if (it == std::sregex_token_iterator()) return false;
-  auto x = getVar(*it++);
-  auto y = getVar(*it++);
-  auto tmp = newTemp();
-  prog->gen_inst(Opc::lai, tmp, y);
-  prog->gen_inst(Opc::ld, x, y);
+  prog->gen_inst(opc, x, y, z);
   return true;
 }
 
+/* *x := y */
 bool Compiler::handle_deref_assign(
-    Program *prog, const std::string &line) {
-  static std::regex pat(
-      R"(^\s*\*(\w+)\s+:=\s+(#[\+\-]?\d+|[&\*]?\w+)\s*$)");
-  auto it = std::sregex_token_iterator(
-      line.begin(), line.end(), pat, m2);
-  if (it == std::sregex_token_iterator()) return false;
-
-  auto x = getVar(*it++);
-  auto y = primary_exp(prog, *it++);
+    Program *prog, const Tokens &toks) {
+  Operand op;
+  if (!is_word(toks, 1) || !is_punct(toks, 2, ":=") ||
+      !parse_last_operand(toks, 3, op))
+    return false;
+
+  auto x = getVar(toks[1].text);
+  auto y = primary_exp(prog, op);
   prog->gen_inst(Opc::st, x, y);
   return true;
 }
 
-bool Compiler::handle_goto_(
-    Program *prog, const std::string &line) {
-  static std::regex pat(R"(^\s*GOTO\s+(\w+)\s*$)");
-  auto it = std::sregex_token_iterator(
-      line.begin(), line.end(), pat, m1);
-  if (it == std::sregex_token_iterator()) { return false; }
+bool Compiler::handle_goto_(Program *prog, const Tokens &toks) {
+  if (toks.size() != 2 || !is_word(toks, 1)) { return false; }
 
-  auto label = *it++;
-  auto label_ptr = labels[label];
-  auto code = prog->gen_inst(
-      Opc::br, ptr_lo(label_ptr), ptr_hi(label_ptr));
-  if (!label_ptr) {
-    backfill_labels[label].push_back(code + 1);
+  auto label = toks[1].text;
+  auto it = labels.find(label);
+  int label_pos = it == labels.end() ? -1 : it->second;
+  auto code = prog->gen_br(label_pos, takeLines());
+  if (label_pos < 0) {
+    backfill_labels[std::string(label)].push_back(code + 1);
   }
   return true;
 }
 
-bool Compiler::handle_branch(
-    Program *prog, const std::string &line) {
-  static std::regex pat(
-      R"(^\s*IF\s+(#[\+\-]?\d+|[&\*]?\w+)\s*(<|>|<=|>=|==|!=)\s*(#[\+\-]?\d+|[&\*]?\w+)\s+GOTO\s+(\w+)\s*$)");
-  auto it = std::sregex_token_iterator(
-      line.begin(), line.end(), pat, m4);
-  if (it == std::sregex_token_iterator()) return false;
-
-  auto x = primary_exp(prog, *it++);
-  auto opc = *it++;
-  auto y = primary_exp(prog, *it++);
-
-  auto label = *it++;
-  auto label_ptr = labels[label];
-
-  static std::map<std::string, Opc> s2op{
-      {"<", Opc::lt},
-      {">", Opc::gt},
-      {"<=", Opc::le},
-      {">=", Opc::ge},
-      {"==", Opc::eq},
-      {"!=", Opc::ne},
-  };
+bool Compiler::handle_branch(Program *prog, const Tokens &toks) {
+  /* compare and branch, register and immediate right operand, and the
+   * relop with its operands swapped */
+  static std::map<std::string_view, std::tuple<Opc, Opc, const char *>>
+      s2op{
+          {"<", {Opc::br_lt_rr, Opc::br_lt_ri, ">"}},
+          {">", {Opc::br_gt_rr, Opc::br_gt_ri, "<"}},
+          {"<=", {Opc::br_le_rr, Opc::br_le_ri, ">="}},
+          {">=", {Opc::br_ge_rr, Opc::br_ge_ri, "<="}},
+          {"==", {Opc::br_eq_rr, Opc::br_eq_ri, "=="}},
+          {"!=", {Opc::br_ne_rr, Opc::br_ne_ri, "!="}},
+      };
+
+  size_t i = 1;
+  Operand lhs, rhs;
+  if (!parse_operand(toks, i, lhs) || i >= toks.size() ||
+      toks[i].kind != Token::punct)
+    return false;
+  auto relop = s2op.find(toks[i++].text);
+  if (relop == s2op.end() || !parse_operand(toks, i, rhs) ||
+      i + 2 != toks.size() || toks[i].text != "GOTO" ||
+      !is_word(toks, i + 1))
+    return false;
+
+  if (lhs.prefix == '#' && rhs.prefix != '#') {
+    std::swap(lhs, rhs);
+    relop = s2op.find(std::get<2>(relop->second));
+  }
+  auto [opc_rr, opc_ri, swapped] = relop->second;
 
-  auto tmp = newTemp();
-  prog->gen_inst(s2op[opc], tmp, x, y);
-  auto code = prog->gen_cond_br(tmp, label_ptr);
-  if (!label_ptr) {
-    backfill_labels[label].push_back(code + 2);
+  auto x = primary_exp(prog, lhs);
+  bool imm = rhs.prefix == '#';
+  auto y = imm ? imm_value(rhs) : primary_exp(prog, rhs);
+
+  auto label = toks[i + 1].text;
+  auto it = labels.find(label);
+  int label_pos = it == labels.end() ? -1 : it->second;
+
+  auto code = prog->gen_br_cmp(
+      imm ? opc_ri : opc_rr, x, y, label_pos, takeLines());
+  if (label_pos < 0) {
+    backfill_labels[std::string(label)].push_back(code + 3);
   }
   return true;
 }
 
-bool Compiler::handle_ret(
-    Program *prog, const std::string &line) {
-  static std::regex pat(
-      R"(^\s*RETURN\s+(#[\+\-]?\d+|[&\*]?\w+)\s*$)");
-  auto it = std::sregex_token_iterator(
-      line.begin(), line.end(), pat, m1);
-  if (it == std::sregex_token_iterator()) return false;
+bool Compiler::handle_ret(Program *prog, const Tokens &toks) {
+  Operand op;
+  if (!parse_last_operand(toks, 1, op)) return false;
 
-  auto x = primary_exp(prog, *it++);
-  prog->gen_inst(Opc::mov, getRet(), x);
-  prog->gen_inst(Opc::ret);
+  if (op.prefix == '#') {
+    prog->gen_inst(Opc::ret_i, imm_value(op), takeLines());
+    return true;
+  }
+  auto x = primary_exp(prog, op);
+  prog->gen_inst(Opc::ret, x, takeLines());
   return true;
 }
 
-bool Compiler::handle_dec(
-    Program *prog, const std::string &line) {
-  static std::regex pat(R"(^\s*DEC\s+(\w+)\s+(\d+)\s*$)");
-  auto it = std::sregex_token_iterator(
-      line.begin(), line.end(), pat, m2);
-  if (it == std::sregex_token_iterator()) return false;
+bool Compiler::handle_dec(Program *prog, const Tokens &toks) {
+  if (toks.size() != 3 || !is_word(toks, 1) || !is_word(toks, 2))
+    return false;
 
-  auto x = *it++;
-  auto size = stoi(*it++);
-  getVar(x, (size + 3) / 4);
+  auto text = toks[2].text;
+  int size = 0;
+  auto res =
+      std::from_chars(text.data(), text.data() + text.size(), size);
+  if (res.ptr != text.data() + text.size()) return false;
+  getVar(toks[1].text, (size + 3) / 4);
   return true;
 }
 
-bool Compiler::handle_arg(
-    Program *prog, const std::string &line) {
-  static std::regex pat(
-      R"(^\s*ARG\s+(#[\+\-]?\d+|[&\*]?\w+)\s*$)");
-  auto it = std::sregex_token_iterator(
-      line.begin(), line.end(), pat, m1);
-  if (it == std::sregex_token_iterator()) return false;
+bool Compiler::handle_arg(Program *prog, const Tokens &toks) {
+  Operand op;
+  if (!parse_last_operand(toks, 1, op)) return false;
 
-  auto tmp = primary_exp(prog, *it++);
+  auto tmp = primary_exp(prog, op);
   prog->gen_inst(Opc::arg, tmp);
   // auto *ptr = prog->gen_inst(Opc::mov, 0, tmp);
   // backfill_args.push_back(ptr);
   return true;
 }
 
-bool Compiler::handle_call(
-    Program *prog, const std::string &line) {
-  static std::regex pat(
-      R"(^\s*(\w+)\s*:=\s*CALL\s+(\w+)\s*$)");
-  auto it = std::sregex_token_iterator(
-      line.begin(), line.end(), pat, m2);
-  if (it == std::sregex_token_iterator()) return false;
-
-  auto to = *it++;
-  auto f = *it++;
+/* x := CALL f */
+bool Compiler::handle_call(Program *prog, const Tokens &toks) {
+  auto to = toks[0].text;
+  auto f = toks[3].text;
 
   /* backfill args */
 #if 0
-  for (auto *arg : backfill_args) {
-	assert (arg[0] == (int)Opc::mov);
-	arg[1] = newArg();
+  for (auto arg : backfill_args) {
+	assert (prog->text[arg] == (int)Opc::mov);
+	prog->text[arg + 1] = newArg();
   }
 #endif
 
@@ -743,52 +1101,39 @@ bool Compiler::handle_call(
   auto ret = newArg();
   auto inc = newArg();
 
-  prog->gen_inst(Opc::li, inc, inc);
-  prog->gen_inst(Opc::inc_esp, inc);
-  prog->gen_call(funcs[f]);
-  prog->gen_inst(Opc::mov, getVar(to), ret);
+  prog->gen_call(inc, getFunction(f), takeLines());
+  prog->gen_mov(getVar(to), ret);
   return true;
 }
 
-bool Compiler::handle_param(
-    Program *prog, const std::string &line) {
-  static std::regex pat(R"(^\s*PARAM\s+(\w+)\s*$)");
-  auto it = std::sregex_token_iterator(
-      line.begin(), line.end(), pat, m1);
-  if (it == std::sregex_token_iterator()) return false;
-  prog->gen_inst(Opc::param, getVar(*it++));
+bool Compiler::handle_param(Program *prog, const Tokens &toks) {
+  if (toks.size() != 2 || !is_word(toks, 1)) return false;
+  prog->gen_inst(Opc::param, getVar(toks[1].text));
   return true;
 }
 
-bool Compiler::handle_read(
-    Program *prog, const std::string &line) {
-  static std::regex pat(R"(^\s*READ\s+(\w+)\s*$)");
-  auto it = std::sregex_token_iterator(
-      line.begin(), line.end(), pat, m1);
-  if (it == std::sregex_token_iterator()) return false;
+bool Compiler::handle_read(Program *prog, const Tokens &toks) {
+  if (toks.size() != 2 || !is_word(toks, 1)) return false;
 
-  auto x = *it++;
-  prog->gen_inst(Opc::read, getVar(x));
+  prog->gen_inst(Opc::read, getVar(toks[1].text));
   return true;
 }
 
-bool Compiler::handle_write(
-    Program *prog, const std::string &line) {
-  static std::regex pat(
-      R"(^\s*WRITE\s+(#[\+\-]?\d+|[&\*]?\w+)\s*$)");
-  auto it = std::sregex_token_iterator(
-      line.begin(), line.end(), pat, m1);
-  if (it == std::sregex_token_iterator()) return false;
+bool Compiler::handle_write(Program *prog, const Tokens &toks) {
+  Operand op;
+  if (!parse_last_operand(toks, 1, op)) return false;
 
-  auto x = primary_exp(prog, *it++);
+  auto x = primary_exp(prog, op);
   prog->gen_inst(Opc::write, x);
   return true;
 }
 
+#ifdef LOGIR
 void log_curir(int *eip, int *esp) {
   const char *s = lohi_to_ptr<char>(eip[0], eip[1]);
   fmt::printf("IR:%03d> %s\n", eip[2], s, s);
 }
+#endif
 
 std::unique_ptr<Program> Compiler::compile(
     std::istream &is) {
@@ -796,14 +1141,14 @@ std::unique_ptr<Program> Compiler::compile(
   static std::vector<std::unique_ptr<char[]>> lines;
 #endif
   auto prog = std::make_unique<Program>();
+  Tokens toks;
   unsigned lineno = 0;
   while ((is.peek(), is.good())) {
-    bool suc = false;
     lineno++;
     std::string line;
     std::getline(is, line);
 
-    prog->gen_inst(Opc::inst_begin);
+    pending_lines++;
 
 #ifdef LOGIR
     char *ir = new char[line.size() + 1];
@@ -824,27 +1169,20 @@ std::unique_ptr<Program> Compiler::compile(
     }
 
     clearTemps();
-    for (int i = (int)Stmt::begin; i < (int)Stmt::end;
-         i++) {
-      if ((this->*handlers[(Stmt)i])(&*prog, line)) {
-        if (i == (int)Stmt::func) temps.clear();
-        ;
-        suc = true;
-        break;
-      }
-    }
-
-    if (suc) continue;
+    if (tokenize(line, toks) && compile_line(&*prog, toks))
+      continue;
 
     fmt::printf("[IGNORED] syntax error at line %d: '%s'\n",
         lineno, line);
     /* IGNORED and continue */
   }
 
-  if (prog->curf[0] == (int)Opc::alloca) {
-    prog->curf[1] = stack_size + 2;
+  if (prog->curf >= 0) {
+    prog->text[prog->curf + 1] = stack_size + 2;
   }
+  flushLines(&*prog);
   prog->gen_inst(Opc::abort);
+  prog->entry = getFunction("main");
   return prog;
 }
 
@@ -1,12 +1,14 @@
 #ifndef IRSIM_H
 #define IRSIM_H
 
+#include <algorithm>
 #include <array>
 #include <iostream>
 #include <limits.h>
 #include <map>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
@@ -14,64 +16,66 @@
 
 namespace irsim {
 
-template <class T>
-int ptr_hi(const T *ptr) {
-  return static_cast<int>(
-      reinterpret_cast<uintptr_t>(ptr) >> 32);
-}
-
-template <class T>
-int ptr_lo(const T *ptr) {
-  return static_cast<int>(reinterpret_cast<uintptr_t>(ptr));
-}
-
-template <class T>
-T *lohi_to_ptr(uint32_t lo, uint32_t hi) {
-  uintptr_t ptr = ((uint64_t)hi << 32) | lo;
-  return reinterpret_cast<T *>(ptr);
-}
-
 /* clang-format off */
 enum class Exception {
   IF, LOAD, STORE, DIV_ZERO, TIMEOUT, OOM, ABORT, INVOP, EOF_OCCUR, NO_EXCEPT,
 };
 
-enum class Stmt {
-  begin,
-  label = Stmt::begin,
-  func, assign, add, sub, mul, div, takeaddr, deref,
-  deref_assign, goto_, branch, ret, dec, arg, call,
-  param, read, write,
-  end,
-};
-
+/* Branches, call, ret and tick end a straight run of IR lines and
+ * carry its length as their last operand, to count executed lines.
+ * Jump targets are offsets from the operand that holds them.
+ * _ri takes an immediate right operand, br_<relop> compares and jumps,
+ * mov2 and mov_li are two moves (or a move and a li) in one op. */
 enum class Opc {
   abort, // as 0
-  inst_begin,
+  if_fault, // target of unresolved jumps and calls
+  tick,
   helper, // native call
-  arg, param, lai, la, ld, st, inc_esp, li, mov, add, sub,
-  mul, div, br, cond_br, lt, le, eq, ge, gt, ne, alloca,
-  call, ret, read, write,
+  arg, param, lai, la, ld, st, li, mov, mov2, mov_li,
+  add, sub, mul, div, add_ri, sub_ri, mul_ri, div_ri,
+  br,
+  br_lt_rr, br_le_rr, br_eq_rr, br_ge_rr, br_gt_rr, br_ne_rr,
+  br_lt_ri, br_le_ri, br_eq_ri, br_ge_ri, br_gt_ri, br_ne_ri,
+  alloca, call, ret, ret_i, read, write,
   quit,
+  NR_OPCS, // not an op
 };
 /* clang-format on */
 
-using TransitionBlock = std::array<int, 4 * 1024>;
+/* a token of one IR line, viewing into the line */
+struct Token {
+  enum Kind { word, imm, punct } kind;
+  std::string_view text;
+};
+
+using Tokens = std::vector<Token>;
+
+/* #imm, &var, *var or var, text excludes the prefix */
+struct Operand {
+  char prefix;
+  std::string_view text;
+};
 
 class ProgramInput {
   std::istream *is;
-  std::vector<int> *vec;
+  std::vector<int> *vec; // read from the back
+  bool vec_eof;
 
   friend class Program;
 
 public:
-  ProgramInput(std::istream &is) : is(&is), vec(nullptr) {}
+  ProgramInput(std::istream &is)
+      : is(&is), vec(nullptr), vec_eof(false) {}
   ProgramInput(std::vector<int> &vec)
-      : is(nullptr), vec(&vec) {}
+      : is(nullptr), vec(&vec), vec_eof(false) {}
   ProgramInput(const ProgramInput &that) = default;
 
   int read() {
     if (vec) {
+      if (vec->empty()) {
+        vec_eof = true;
+        return 0;
+      }
       auto ret = vec->back();
       vec->pop_back();
       return ret;
@@ -83,7 +87,7 @@ public:
     }
   }
   bool eof() {
-      return is->eof();
+      return vec ? vec_eof : is->eof();
   }
 };
 
@@ -123,16 +127,27 @@ class Program {
 
   unsigned inst_counter;
 
-  std::vector<std::unique_ptr<TransitionBlock>> codes;
-  TransitionBlock *curblk;
-  int *textptr;
+  /* one relocatable buffer, or the mapped image it was saved to */
+  std::vector<int> text;
+  void *image;
+  size_t image_size;
+  int *code;
+  size_t code_size;
+  int entry;
+  bool threaded;
+
+  /* index of the last op, and where a label points, nothing may be
+   * fused into the op before it */
+  size_t last_inst;
+  size_t label_mark;
 
-  std::vector<std::unique_ptr<int[]>> mempool;
+  /* the startup code and the slot of its call, pointed at the entry */
+  size_t start, start_call;
 
   /* running context */
   std::vector<int> stack;
   int *esp;
-  int *curf;
+  int curf;
 
   friend class Compiler;
 
@@ -145,20 +160,47 @@ public:
         memory_limit(4 * 1024 * 1024), insts_limit(-1u) {
     exception = Exception::NO_EXCEPT;
     inst_counter = 0;
-    curblk = new TransitionBlock;
-    codes.push_back(
-        std::unique_ptr<TransitionBlock>(curblk));
-    textptr = &curblk->at(0);
-
-    curf = gen_inst(Opc::quit, Opc::quit);
+    image = nullptr;
+    image_size = 0;
+    code = nullptr;
+    code_size = 0;
+    entry = -1;
+    threaded = false;
+    last_inst = label_mark = 0;
+    curf = -1;
+
+    gen_inst(Opc::if_fault);
+    auto ret = 2, inc = 3;
+    start = gen_inst(Opc::alloca, 4);
+    gen_inst(Opc::li, ret, 0);
+    start_call = gen_call(inc, -1, 0) + 2;
+    gen_inst(Opc::quit);
   }
 
+  Program(const Program &) = delete;
+  ~Program();
+
+  /* a program written by save() is mapped back instead of being
+   * compiled again, load() is null if it is stale or broken */
+  static bool is_image(const char *path);
+  static std::unique_ptr<Program> load(const char *path);
+  bool save(const char *path) const;
+
   void setMemoryLimit(unsigned lim) { memory_limit = lim; }
 
   void setInstsLimit(unsigned lim) { insts_limit = lim; }
 
   unsigned getInstCounter() const { return inst_counter; }
 
+  int getEntry() const { return entry; }
+
+  /* forget the last run, the compiled code is kept */
+  void reset() {
+    exception = Exception::NO_EXCEPT;
+    inst_counter = 0;
+    std::fill(stack.begin(), stack.end(), 0);
+  }
+
   void setIO(ProgramIO io) { this->io = io; }
   void setInput(ProgramInput in) {
     static_cast<ProgramInput &>(this->io) = in;
@@ -167,106 +209,137 @@ public:
     static_cast<ProgramOutput &>(this->io) = out;
   }
 
-  int *get_textptr() const { return textptr; }
-  void check_eof(unsigned N) {
-    if (textptr + N + 2 >= &(*curblk)[curblk->size()]) {
-      curblk = new TransitionBlock;
-      codes.push_back(
-          std::unique_ptr<TransitionBlock>(curblk));
-      *textptr++ = (int)Opc::br;
-      *textptr++ = ptr_lo(&(curblk->at(0)));
-      *textptr++ = ptr_hi(&(curblk->at(0)));
-      textptr = &curblk->at(0);
-    }
+  int get_textptr() const { return text.size(); }
+
+  int place_label() {
+    label_mark = text.size();
+    return text.size();
+  }
+
+  /* offset stored in slot to jump to target, unresolved ones fault */
+  static int rel(size_t slot, int target) {
+    return (target < 0 ? 0 : target) - (int)slot;
+  }
+
+  void set_target(size_t slot, int target) {
+    text[slot] = rel(slot, target);
   }
 
   template <class... Args>
-  int *gen_inst(Opc opc, Args... args) {
+  int gen_inst(Opc opc, Args... args) {
     constexpr unsigned N = sizeof...(args);
-    check_eof(N + 1);
-    auto oldptr = textptr;
-    *textptr++ = (int)opc;
+    int oldpos = text.size();
+    last_inst = oldpos;
+    text.push_back((int)opc);
     for (int v :
         std::array<int, N>{static_cast<int>(args)...}) {
-      *textptr++ = v;
+      text.push_back(v);
     }
 
 #ifdef DEBUG
-    fmt::printf(
-        "  %p: %s", fmt::ptr(oldptr), opc_to_string[opc]);
+    fmt::printf("  %d: %s", oldpos, opc_to_string[opc]);
     for (int v :
         std::array<int, N>{static_cast<int>(args)...}) {
       fmt::printf("0x%x ", v);
     }
     fmt::printf("\n");
 #endif
-    return oldptr;
+    return oldpos;
+  }
+
+  /* the last op, if the next one may be fused into it */
+  int *fusable(Opc opc) {
+    if (label_mark == text.size() || last_inst + 3 != text.size() ||
+        text[last_inst] != (int)opc)
+      return nullptr;
+    return &text[last_inst];
+  }
+
+  void gen_mov(int to, int from) {
+    if (int *last = fusable(Opc::mov)) {
+      last[0] = (int)Opc::mov2;
+      text.push_back(to);
+      text.push_back(from);
+    } else {
+      gen_inst(Opc::mov, to, from);
+    }
+  }
+
+  void gen_li(int to, int value) {
+    if (int *last = fusable(Opc::mov)) {
+      last[0] = (int)Opc::mov_li;
+      text.push_back(to);
+      text.push_back(value);
+    } else {
+      gen_inst(Opc::li, to, value);
+    }
   }
 
-  int *gen_call(int *target) {
-    return gen_inst(
-        Opc::call, ptr_lo(target), ptr_hi(target));
+  /* the callee's frame starts at esp + inc */
+  int gen_call(int inc, int target, unsigned lines) {
+    auto pos = text.size();
+    return gen_inst(Opc::call, inc, rel(pos + 2, target), lines);
   }
 
-  int *gen_br(int *target) {
-    return gen_inst(
-        Opc::br, ptr_lo(target), ptr_hi(target));
+  int gen_br(int target, unsigned lines) {
+    auto pos = text.size();
+    return gen_inst(Opc::br, rel(pos + 1, target), lines);
   }
 
-  int *gen_cond_br(int cond, int *target) {
-    return gen_inst(
-        Opc::cond_br, cond, ptr_lo(target), ptr_hi(target));
+  /* br_<relop> lhs, rhs, target */
+  int gen_br_cmp(Opc opc, int lhs, int rhs, int target,
+      unsigned lines) {
+    auto pos = text.size();
+    return gen_inst(opc, lhs, rhs, rel(pos + 3, target), lines);
   }
 
-  int run(int *eip);
+  int run(int entry);
 };
 
 class Compiler {
   int stack_size;
   int args_size;
 
-  std::map<std::string, int> vars;
-  std::map<std::string, int *> funcs;
-  std::map<std::string, int *> labels;
+  std::map<std::string, int, std::less<>> vars;
+  std::map<std::string, int, std::less<>> funcs;
+  std::map<std::string, int, std::less<>> labels;
 
   std::map<int, bool> temps;
 
-  std::map<std::string, std::vector<int *>> backfill_labels;
+  /* slots waiting for a label's position */
+  std::map<std::string, std::vector<int>, std::less<>>
+      backfill_labels;
 
-  std::vector<int *> backfill_args;
+  /* IR lines since the last instruction that counted them */
+  unsigned pending_lines;
 
-  static std::map<Stmt,
-      bool (Compiler::*)(Program *, const std::string &)>
-      handlers;
+  std::vector<int> backfill_args;
 
-  static constexpr int m1[] = {1};
-  static constexpr int m2[] = {1, 2};
-  static constexpr int m3[] = {1, 2, 3};
-  static constexpr int m4[] = {1, 2, 3, 4};
+  using Handler = bool (Compiler::*)(Program *, const Tokens &);
+  static std::map<std::string_view, Handler> keywords;
 
-  int primary_exp(Program *prog, const std::string &tok,
+  int primary_exp(Program *prog, const Operand &op,
       int to = INT_MAX);
-
-  bool handle_label(Program *, const std::string &line);
-  bool handle_func(Program *, const std::string &line);
-  bool handle_assign(Program *, const std::string &line);
-  bool handle_arith(Program *, const std::string &line);
-  bool handle_takeaddr(Program *, const std::string &line);
-  bool handle_deref(Program *, const std::string &line);
-  bool handle_deref_assign(
-      Program *, const std::string &line);
-  bool handle_goto_(Program *, const std::string &line);
-  bool handle_branch(Program *, const std::string &line);
-  bool handle_ret(Program *, const std::string &line);
-  bool handle_dec(Program *, const std::string &line);
-  bool handle_arg(Program *, const std::string &line);
-  bool handle_call(Program *, const std::string &line);
-  bool handle_param(Program *, const std::string &line);
-  bool handle_read(Program *, const std::string &line);
-  bool handle_write(Program *, const std::string &line);
+  int imm_value(const Operand &op);
+
+  bool compile_line(Program *, const Tokens &toks);
+
+  bool handle_label(Program *, const Tokens &toks);
+  bool handle_func(Program *, const Tokens &toks);
+  bool handle_assign(Program *, const Tokens &toks);
+  bool handle_deref_assign(Program *, const Tokens &toks);
+  bool handle_goto_(Program *, const Tokens &toks);
+  bool handle_branch(Program *, const Tokens &toks);
+  bool handle_ret(Program *, const Tokens &toks);
+  bool handle_dec(Program *, const Tokens &toks);
+  bool handle_arg(Program *, const Tokens &toks);
+  bool handle_call(Program *, const Tokens &toks);
+  bool handle_param(Program *, const Tokens &toks);
+  bool handle_read(Program *, const Tokens &toks);
+  bool handle_write(Program *, const Tokens &toks);
 
 public:
-  Compiler() { clear_env(); }
+  Compiler() : pending_lines(0) { clear_env(); }
 
   void clear_env() {
     stack_size = 1;
@@ -275,11 +348,12 @@ public:
     labels.clear();
   }
 
-  int *getFunction(const std::string &fname) {
-    return funcs[fname];
+  int getFunction(std::string_view fname) {
+    auto it = funcs.find(fname);
+    return it == funcs.end() ? -1 : it->second;
   }
 
-  int getVar(const std::string &name, unsigned size = 1) {
+  int getVar(std::string_view name, unsigned size = 1) {
     auto it = vars.find(name);
     if (it == vars.end()) {
       std::tie(it, std::ignore) = vars.insert(
@@ -311,7 +385,17 @@ public:
     return stack_size - 1;
   }
 
-  int getRet() { return -1; }
+  unsigned takeLines() {
+    auto lines = pending_lines;
+    pending_lines = 0;
+    return lines;
+  }
+
+  /* counts the pending lines where control falls through into a
+   * label, so a jump to the label skips them */
+  void flushLines(Program *prog) {
+    if (pending_lines) prog->gen_inst(Opc::tick, takeLines());
+  }
 
   int getParam(const std::string &name) {
     auto it = vars.find(name);
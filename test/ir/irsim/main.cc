@@ -1,29 +1,210 @@
 #include "fmt/printf.h"
 #include "irsim.h"
 
+#include <cctype>
+#include <cstring>
 #include <fstream>
+#include <sstream>
 #include <string>
 
-int main(int argc, const char *argv[]) {
-  if (argc <= 1) {
-    fmt::printf("usage: irsim [*.ir]\n");
+namespace {
+
+/* nested arrays of integers, all the JSON a test vector file holds */
+struct Json {
+  bool is_num = false;
+  int num = 0;
+  std::vector<Json> items;
+};
+
+struct JsonReader {
+  const char *p, *end;
+
+  void skip() {
+    while (p < end && isspace((unsigned char)*p)) p++;
+  }
+
+  bool value(Json &v) {
+    skip();
+    if (p < end && *p == '[') {
+      p++;
+      skip();
+      if (p < end && *p == ']') return p++, true;
+      while (true) {
+        v.items.emplace_back();
+        if (!value(v.items.back())) return false;
+        skip();
+        if (p < end && *p == ',') {
+          p++;
+        } else if (p < end && *p == ']') {
+          return p++, true;
+        } else {
+          return false;
+        }
+      }
+    }
+    char *num_end;
+    long num = strtol(p, &num_end, 10);
+    if (num_end == p) return false;
+    p = num_end;
+    v.is_num = true;
+    v.num = (int)num;
+    return true;
+  }
+};
+
+/* a JSON array with one entry per vector, either the input itself or
+ * [input, output, ret] as in the suites' .json files; otherwise one
+ * vector per line of whitespace separated integers */
+bool read_batch(
+    const char *path, std::vector<std::vector<int>> &batch) {
+  std::ifstream ifs(path);
+  if (!ifs.good()) return false;
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  std::string data = ss.str();
+
+  auto first = data.find_first_not_of(" \t\r\n");
+  if (first != std::string::npos && data[first] == '[') {
+    Json root;
+    JsonReader reader{data.data(), data.data() + data.size()};
+    if (!reader.value(root) || root.is_num) return false;
+    for (auto &entry : root.items) {
+      auto *in = &entry;
+      if (!in->items.empty() && !in->items[0].is_num)
+        in = &in->items[0];
+      if (in->is_num) return false;
+      batch.emplace_back();
+      for (auto &v : in->items) {
+        if (!v.is_num) return false;
+        batch.back().push_back(v.num);
+      }
+    }
+    return true;
+  }
+
+  std::istringstream lines(data);
+  std::string line;
+  while (std::getline(lines, line)) {
+    std::istringstream ls(line);
+    batch.emplace_back();
+    int v;
+    while (ls >> v) batch.back().push_back(v);
+    if (!ls.eof()) return false;
+  }
+  return true;
+}
+
+/* runs every vector on the same program, returns the first non-zero
+ * exit code */
+int run_batch(irsim::Program &prog,
+    const std::vector<std::vector<int>> &batch) {
+  int result = 0;
+  for (size_t i = 0; i < batch.size(); i++) {
+    /* the input is read from the back */
+    std::vector<int> in(batch[i].rbegin(), batch[i].rend());
+    std::vector<int> out;
+    prog.reset();
+    prog.setIO(irsim::ProgramIO(in, out));
+    auto code = prog.run(prog.getEntry());
+
+    fmt::printf("vector %d\n", i + 1);
+    for (int v : out) fmt::printf("%d\n", v);
+    fmt::print("ret with {}, reason {}\n{}\n", code,
+        prog.exception, prog.getInstCounter());
+    if (code && !result) result = code;
+  }
+  return result;
+}
+
+/* an image is mapped, IR is compiled, null after printing why not */
+std::unique_ptr<irsim::Program> load_program(const char *path) {
+  using namespace irsim;
+  std::unique_ptr<Program> prog;
+  if (Program::is_image(path)) {
+    prog = Program::load(path);
+    if (!prog) fmt::printf("'%s' is a stale or broken image\n", path);
+  } else {
+    std::ifstream ifs(path);
+    if (!ifs.good()) {
+      fmt::printf("'%s' no such file\n", path);
+      return nullptr;
+    }
+    Compiler compiler;
+    prog = compiler.compile(ifs);
+  }
+  if (prog) {
+    prog->setInstsLimit(-1u);
+    prog->setMemoryLimit(128 * 1024 * 1024);
+  }
+  return prog;
+}
+
+int batch_file(const char *batch_from, const char *path) {
+  fmt::printf("load %s\n", path);
+  auto prog = load_program(path);
+  if (!prog) return -1;
+
+  std::vector<std::vector<int>> batch;
+  if (!read_batch(batch_from, batch)) {
+    fmt::printf("'%s' is not a batch of vectors\n", batch_from);
     return -1;
   }
+  return run_batch(*prog, batch);
+}
+
+/* one warm irsim for a test runner: every "VECTORS PROGRAM" line on
+ * stdin is answered as irsim -b VECTORS PROGRAM would, then "end" */
+int serve() {
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    std::istringstream ls(line);
+    std::string batch_from, path;
+    if (!(ls >> batch_from) || !std::getline(ls >> std::ws, path))
+      continue;
+    batch_file(batch_from.c_str(), path.c_str());
+    fmt::printf("end\n");
+    fflush(stdout);
+  }
+  return 0;
+}
+
+} // namespace
 
-  fmt::printf("load %s\n", argv[1]);
-  std::ifstream ifs(argv[1]);
+int main(int argc, const char *argv[]) {
+  /* irsim -c out.irb in.ir compiles once, later runs map out.irb,
+   * irsim -b vectors in.ir runs in.ir once per input vector,
+   * irsim -s serves such batches to a test runner */
+  if (argc == 2 && strcmp(argv[1], "-s") == 0) return serve();
+  if (argc > 3 && strcmp(argv[1], "-b") == 0)
+    return batch_file(argv[2], argv[3]);
+
+  const char *save_to = nullptr;
+  int argi = 1;
+  if (argc > 3 && strcmp(argv[1], "-c") == 0) {
+    save_to = argv[2];
+    argi = 3;
+  }
 
-  if (!ifs.good()) {
-    fmt::printf("'%s' no such file\n", argv[1]);
+  if (argc <= argi) {
+    fmt::printf("usage: irsim [-c image | -b vectors] [*.ir | image]\n"
+                "       irsim -s\n");
     return -1;
   }
 
-  using namespace irsim;
-  Compiler compiler;
-  auto prog = compiler.compile(ifs);
-  prog->setInstsLimit(-1u);
-  prog->setMemoryLimit(128 * 1024 * 1024);
-  auto code = prog->run(compiler.getFunction("main"));
+  const char *path = argv[argi];
+  fmt::printf("load %s\n", path);
+  auto prog = load_program(path);
+  if (!prog) return -1;
+
+  if (save_to) {
+    if (!prog->save(save_to)) {
+      fmt::printf("cannot save '%s'\n", save_to);
+      return -1;
+    }
+    return 0;
+  }
+
+  auto code = prog->run(prog->getEntry());
   fmt::print("ret with {}, reason {}\n{}\n", code,
       prog->exception, prog->getInstCounter());
   return code;
@@ -0,0 +1,279 @@
+#!/usr/bin/env python3
+# Runs the ir and asm suites sharded over several workers.
+# Each worker owns a workdir and, for ir, one warm `irsim -s` that
+# is fed every test it gets. A json report with per test timing is
+# written at the end.
+#
+#   ./run_parallel.py ../src/ncc [-j N] [--report FILE] [ir] [asm]
+
+import argparse
+import json
+import os
+import queue
+import select
+import shlex
+import subprocess
+import threading
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+RED = '\033[1m\033[91m'
+NC = '\033[0m\033[0m'
+
+
+class Timeout(Exception):
+    pass
+
+
+class Failure(Exception):
+    def __init__(self, status, message):
+        super().__init__(message)
+        self.status = status
+        self.message = message
+
+
+class Irsim:
+    """An `irsim -s` kept alive across tests, restarted after a hang."""
+
+    def __init__(self, binary):
+        self.binary = binary
+        self.proc = None
+
+    def start(self):
+        self.proc = subprocess.Popen([self.binary, '-s'],
+                                     stdin=subprocess.PIPE,
+                                     stdout=subprocess.PIPE,
+                                     stderr=subprocess.DEVNULL)
+        self.buf = b''
+
+    def stop(self):
+        if self.proc:
+            self.proc.kill()
+            self.proc.wait()
+            self.proc = None
+
+    def readline(self, deadline):
+        while b'\n' not in self.buf:
+            left = deadline - time.monotonic()
+            if left <= 0 or not select.select([self.proc.stdout], [], [], left)[0]:
+                raise Timeout()
+            chunk = os.read(self.proc.stdout.fileno(), 65536)
+            if not chunk:
+                raise Failure('RE', 'irsim exited')
+            self.buf += chunk
+        line, self.buf = self.buf.split(b'\n', 1)
+        return line.decode()
+
+    def batch(self, vectors, program, timeout):
+        if self.proc is None or self.proc.poll() is not None:
+            self.start()
+        self.proc.stdin.write(('%s %s\n' % (vectors, program)).encode())
+        self.proc.stdin.flush()
+        deadline = time.monotonic() + timeout
+        lines = []
+        try:
+            while True:
+                line = self.readline(deadline)
+                if line == 'end':
+                    return lines
+                lines.append(line)
+        except (Timeout, Failure):
+            self.stop()
+            raise
+
+
+def check_ir(lines, tests):
+    """Same verdicts as ir/check.py, returns the instruction count."""
+    pos = 1  # "load ..."
+    total = 0
+    for data_in, data_out, _ in tests:
+        if pos >= len(lines) or not lines[pos].startswith('vector '):
+            raise Failure('RE', 'irsim stopped on input %s: %s'
+                          % (data_in, lines[-1] if lines else ''))
+        pos += 1
+        user_out = []
+        while pos < len(lines) and not lines[pos].startswith('ret with '):
+            user_out.append(lines[pos])
+            pos += 1
+        if pos + 1 >= len(lines):
+            raise Failure('RE', 'irsim stopped on input %s' % data_in)
+        ret_line, count_line = lines[pos], lines[pos + 1]
+        pos += 2
+        if ret_line != 'ret with 0, reason 0':
+            raise Failure('RE', 'input %s: %s' % (data_in, ret_line))
+        try:
+            user_out = [int(v) for v in user_out]
+        except ValueError:
+            raise Failure('WA', 'input %s: output is not a number' % data_in)
+        if user_out != data_out:
+            raise Failure('WA', 'input %s: expected %s, found %s'
+                          % (data_in, data_out, user_out))
+        total += int(count_line)
+    return total
+
+
+def only_nums(text):
+    for s in text.replace('Enter an integer:', ' ').split():
+        try:
+            yield int(s)
+        except ValueError:
+            pass
+
+
+def run_spim(spim, asm, tests, timeout):
+    """Same verdicts as asm/check.py, spim is started per vector."""
+    for data_in, data_out, _ in tests:
+        stdin = ''.join('%d\n' % v for v in data_in)
+        try:
+            res = subprocess.run(spim + [asm], input=stdin.encode(),
+                                 stdout=subprocess.PIPE,
+                                 stderr=subprocess.DEVNULL, timeout=timeout)
+        except subprocess.TimeoutExpired:
+            raise Timeout()
+        if res.returncode != 0:
+            raise Failure('RE', 'input %s: spim exited with %d'
+                          % (data_in, res.returncode))
+        user_out = list(only_nums(res.stdout.decode(errors='replace')))
+        if user_out != data_out:
+            raise Failure('WA', 'input %s: expected %s, found %s'
+                          % (data_in, data_out, user_out))
+
+
+class Worker(threading.Thread):
+    def __init__(self, wid, args, jobs, results):
+        super().__init__(daemon=True)
+        self.wid = wid
+        self.args = args
+        self.jobs = jobs
+        self.results = results
+        self.irsim = Irsim(args.irsim)
+
+    def run(self):
+        try:
+            while True:
+                try:
+                    suite, cmm = self.jobs.get_nowait()
+                except queue.Empty:
+                    return
+                self.results.append(self.run_test(suite, cmm))
+        finally:
+            self.irsim.stop()
+
+    def run_test(self, suite, cmm):
+        args = self.args
+        workdir = os.path.join(HERE, suite, 'workdir', 'w%d' % self.wid)
+        os.makedirs(workdir, exist_ok=True)
+        name = os.path.basename(cmm)
+        result = {'suite': suite, 'name': name, 'worker': self.wid,
+                  'status': 'OK', 'message': '', 'vectors': 0,
+                  'compile_time': 0.0, 'run_time': 0.0}
+        out = os.path.join(workdir, 'a.ir' if suite == 'ir' else 'a.s')
+        json_file = cmm[:-len('.cmm')] + '.json'
+
+        phase, start = 'compile_time', time.monotonic()
+        try:
+            tests = json.load(open(json_file))
+            result['vectors'] = len(tests)
+            cmd = [args.ncc, cmm, out] + (['--ir'] if suite == 'ir' else [])
+            try:
+                res = subprocess.run(cmd, stdout=subprocess.DEVNULL,
+                                     stderr=subprocess.DEVNULL,
+                                     timeout=args.timeout)
+            except subprocess.TimeoutExpired:
+                raise Failure('CE', 'ncc timed out')
+            if res.returncode != 0:
+                raise Failure('CE', 'ncc exited with %d' % res.returncode)
+            result[phase] = time.monotonic() - start
+
+            phase, start = 'run_time', time.monotonic()
+            if suite == 'ir':
+                lines = self.irsim.batch(json_file, out, args.timeout)
+                result['instructions'] = check_ir(lines, tests)
+            else:
+                run_spim(args.spim, out, tests, args.timeout)
+        except Timeout:
+            result['status'] = 'TLE'
+        except Failure as f:
+            result['status'] = f.status
+            result['message'] = f.message
+        finally:
+            result[phase] = time.monotonic() - start
+
+        if result['status'] != 'OK':
+            print('%stest [%s/%s] %s %s%s' % (RED, suite, name,
+                  result['status'], result['message'], NC), flush=True)
+        elif args.verbose:
+            print('test [%s/%s] matched' % (suite, name), flush=True)
+        return result
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Run the ir and asm suites on several workers.')
+    parser.add_argument('ncc', help='path to the compiler')
+    parser.add_argument('suites', nargs='*', metavar='ir|asm',
+                        default=['ir', 'asm'])
+    parser.add_argument('-j', '--jobs', type=int, default=os.cpu_count())
+    parser.add_argument('--report', default='report.json',
+                        help='where to write the json report')
+    parser.add_argument('--timeout', type=float, default=10,
+                        help='seconds for one compile or one test run')
+    parser.add_argument('--irsim',
+                        default=os.path.join(HERE, 'ir/irsim/build/irsim'))
+    parser.add_argument('--spim', default='spim -file',
+                        help='command that runs one .s file')
+    parser.add_argument('-v', '--verbose', action='store_true')
+    args = parser.parse_args()
+    for suite in args.suites:
+        if suite not in ('ir', 'asm'):
+            parser.error('unknown suite %s' % suite)
+    args.ncc = os.path.abspath(args.ncc)
+    args.spim = shlex.split(args.spim)
+
+    if 'ir' in args.suites:
+        subprocess.run(['make', '-s', '-C', os.path.join(HERE, 'ir/irsim')],
+                       check=True)
+
+    # biggest first, so a long test does not start last
+    cmms = []
+    for suite in args.suites:
+        tests = os.path.join(HERE, suite, 'tests')
+        cmms += [(suite, os.path.join(tests, f))
+                 for f in os.listdir(tests) if f.endswith('.cmm')]
+    cmms.sort(key=lambda t: -os.path.getsize(t[1][:-4] + '.json'))
+    jobs = queue.Queue()
+    for t in cmms:
+        jobs.put(t)
+
+    results = []
+    start = time.monotonic()
+    workers = [Worker(i, args, jobs, results)
+               for i in range(max(1, min(args.jobs, len(cmms))))]
+    for w in workers:
+        w.start()
+    for w in workers:
+        w.join()
+    wall = time.monotonic() - start
+
+    results.sort(key=lambda r: (r['suite'], r['name']))
+    failed = [r for r in results if r['status'] != 'OK']
+    report = {
+        'jobs': len(workers),
+        'wall_time': wall,
+        'passed': len(results) - len(failed),
+        'failed': len(failed),
+        'instructions': sum(r.get('instructions', 0) for r in results),
+        'tests': results,
+    }
+    with open(args.report, 'w') as f:
+        json.dump(report, f, indent=2)
+
+    print('%d passed, %d failed in %.2fs on %d workers, irsim executes '
+          'about %d instructions' % (report['passed'], report['failed'],
+                                     wall, len(workers),
+                                     report['instructions']))
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    exit(main())
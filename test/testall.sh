@@ -36,6 +36,15 @@ else
 fi
 cd ..
 
+echo Driver
+cd driver
+if ./run.sh ../../src/ncc; then
+  true
+else
+  CODE=-1
+fi
+cd ..
+
 echo ASM
 cd asm
 if ./run.sh ../../src/ncc; then
@@ -0,0 +1,56 @@
+#ifndef __IRFIXTURE_H__
+#define __IRFIXTURE_H__
+
+#include "ast.h"
+#include "object.h"
+#include "intern.h"
+
+// IR built by hand for the tests of passes over ast. begin() starts an
+// empty program, emit appends codes and tree() wraps them up.
+
+static vector *codes = NULL;
+static vector *vars = NULL;
+
+static void begin()
+{
+    codes = new_vector();
+    vars = new_vector();
+}
+
+static irlabel *label(const char *name)
+{
+    irlabel *result = new (irlabel);
+    result->name = intern(name);
+    return result;
+}
+
+static irvar *var()
+{
+    irvar *result = new (irvar);
+    result->id = vars->len + 1;
+    result->name = intern("t");
+    result->isref = false;
+    vector_push(vars, result);
+    return result;
+}
+
+static ircode *emit(irc_type kind)
+{
+    ircode *code = new (ircode);
+    code->kind = kind;
+    code->ignore = false;
+    vector_push(codes, code);
+    return code;
+}
+
+static ast *tree()
+{
+    ast *result = new (ast);
+    result->len = codes->len;
+    result->codes = codes->data;
+    result->var_count = vars->len;
+    result->vars = vars;
+    return result;
+}
+
+#endif
@@ -36,6 +36,7 @@ rm -f ./workdir/main.o
 cp ./main.c ./workdir
 cp ./Makefile ./workdir
 cp ./unittest.h ./workdir
+cp ./irfixture.h ./workdir
 
 report_error(){
   echo -e "${RED}module [$(basename $fcmm)]" "$1" "${NC}"
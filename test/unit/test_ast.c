@@ -0,0 +1,38 @@
+#include "unittest.h"
+#include "ast.h"
+#include "object.h"
+
+testdef(operands)
+{
+    irvar *a = new (irvar), *b = new (irvar);
+    testassert(op_var(a) == op_var(a) && op_var(a) != op_var(b), "var operand is not shared");
+    testassert(op_ref(a) == op_ref(a) && op_ref(a) != op_var(a), "ref operand is not shared");
+    testassert(op_deref(a) == op_deref(a) && op_deref(a)->kind == IRO_Deref, "deref operand is not shared");
+    a->isref = true;
+    testassert(op_rval(a) == op_deref(a) && op_rval(b) == op_var(b), "rval failed");
+    testpass();
+}
+
+testdef(constants)
+{
+    irop *zero = op_const(0);
+    testassert(zero->kind == IRO_Constant && zero->value == 0, "constant operand is wrong");
+    testassert(op_const(-1) != zero, "different constants are shared");
+    for (int i = -5000; i < 5000; i++)
+        testassert(op_const(i)->value == i, "constant %d is wrong", i);
+    testassert(op_const(0) == zero, "constant moved after growing");
+
+    // constants made inside an arena outlive it
+    arena_phase last = arena_enter(ARENA_IR);
+    irop *big = op_const(123456789);
+    arena_enter(last);
+    arena_release(ARENA_IR);
+    testassert(op_const(123456789) == big && big->value == 123456789, "constant is released with the arena");
+    testpass();
+}
+
+void test_init()
+{
+    testreg(operands);
+    testreg(constants);
+}
@@ -0,0 +1,121 @@
+#include "unittest.h"
+#include "cfg.h"
+#include "irfixture.h"
+
+static void emit_label(irc_type kind, const char *name)
+{
+    emit(kind)->label = label(name);
+}
+
+static void emit_assign()
+{
+    ircode *code = emit(IR_Assign);
+    code->assign.left = op_const(0);
+    code->assign.right = op_const(0);
+}
+
+static void emit_branch(const char *target)
+{
+    ircode *code = emit(IR_Branch);
+    code->branch.op1 = op_const(0);
+    code->branch.op2 = op_const(1);
+    code->branch.relop = RT_LE;
+    code->branch.target = label(target);
+}
+
+static void emit_return()
+{
+    emit(IR_Return)->ret = op_const(0);
+}
+
+// FUNCTION main      B0
+// ...
+// LABEL l1           B1, outer loop header
+// IF ... GOTO l2
+// ...                B2
+// LABEL l3           B3, inner loop header
+// IF ... GOTO l4
+// ...                B4
+// GOTO l3
+// LABEL l4           B5
+// GOTO l1
+// LABEL l2           B6
+// RETURN
+// LABEL l5           B7, unreachable
+// RETURN
+static ast *loops()
+{
+    begin();
+    emit_label(IR_Func, "main");
+    emit_assign();
+    emit_label(IR_Label, "l1");
+    emit_branch("l2");
+    emit_assign();
+    emit_label(IR_Label, "l3");
+    emit_branch("l4");
+    emit_assign();
+    emit_label(IR_Goto, "l3");
+    emit_label(IR_Label, "l4");
+    emit_assign();
+    emit_label(IR_Goto, "l1");
+    emit_label(IR_Label, "l2");
+    emit_return();
+    emit_label(IR_Label, "l5");
+    emit_return();
+    return tree();
+}
+
+testdef(blocks)
+{
+    cfg *g = cfg_build(loops());
+    testassert(g->func_count == 1, "function count failed");
+    cfg_func *f = g->funcs[0];
+    testassert(f->block_count == 8, "block count failed: %d", f->block_count);
+    int begins[] = {0, 2, 4, 5, 7, 9, 12, 14};
+    for (int i = 0; i < 8; i++)
+        testassert(f->blocks[i]->begin == begins[i], "block %d begin failed", i);
+    basic_block **b = f->blocks;
+    testassert(g->block_of[3] == b[1] && g->block_of[15] == b[7], "block of code failed");
+    testassert(b[1]->succ_count == 2 && b[1]->succs[0] == b[2] && b[1]->succs[1] == b[6], "branch succs failed");
+    testassert(b[4]->succ_count == 1 && b[4]->succs[0] == b[3], "goto succs failed");
+    testassert(b[6]->succ_count == 0, "return succs failed");
+    testassert(b[1]->pred_count == 2 && b[3]->pred_count == 2, "preds failed");
+    testassert(f->order_count == 7 && f->order[0] == b[0], "reverse postorder failed");
+    testassert(b[7]->rpo == -1, "unreachable block is numbered");
+    testpass();
+}
+
+testdef(dominators)
+{
+    cfg *g = cfg_build(loops());
+    basic_block **b = g->funcs[0]->blocks;
+    testassert(b[1]->idom == b[0] && b[3]->idom == b[2] && b[5]->idom == b[3], "idom failed");
+    testassert(cfg_dominates(b[1], b[6]), "header does not dominate exit");
+    testassert(cfg_dominates(b[3], b[5]), "inner header does not dominate its exit");
+    testassert(!cfg_dominates(b[4], b[5]), "loop body dominates exit");
+    testassert(cfg_dominates(b[2], b[2]), "dominance is not reflexive");
+    testassert(!cfg_dominates(b[0], b[7]), "unreachable block is dominated");
+    testpass();
+}
+
+testdef(loops)
+{
+    cfg *g = cfg_build(loops());
+    cfg_func *f = g->funcs[0];
+    basic_block **b = f->blocks;
+    testassert(f->loop_count == 2, "loop count failed: %d", f->loop_count);
+    cfg_loop *outer = f->loops[0], *inner = f->loops[1];
+    testassert(outer->header == b[1] && outer->block_count == 5, "outer loop failed");
+    testassert(inner->header == b[3] && inner->block_count == 2, "inner loop failed");
+    testassert(inner->parent == outer && outer->parent == NULL, "loop nesting failed");
+    testassert(cfg_loop_depth(b[0]) == 0 && cfg_loop_depth(b[2]) == 1 && cfg_loop_depth(b[4]) == 2, "loop depth failed");
+    testassert(cfg_loop_depth(b[5]) == 1 && cfg_loop_depth(b[6]) == 0, "loop exit depth failed");
+    testpass();
+}
+
+void test_init()
+{
+    testreg(blocks);
+    testreg(dominators);
+    testreg(loops);
+}
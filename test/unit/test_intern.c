@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <string.h>
+#include "unittest.h"
+#include "intern.h"
+
+testdef(intern)
+{
+    char buffer[64];
+    strcpy(buffer, "name");
+    const char *a = intern("name");
+    const char *b = intern(buffer);
+    testassert(a == b, "same string is not interned once");
+    testassert(a != buffer, "interned string is not copied");
+    testassert(strcmp(a, "name") == 0, "interned string is wrong");
+    testassert(intern("other") != a, "different strings are interned together");
+    testassert(internf("t%d", 12) == intern("t12"), "internf failed");
+    testpass();
+}
+
+testdef(many)
+{
+    char buffer[64];
+    const char *first = intern("s0");
+    int count = intern_count();
+    for (int i = 0; i < 100000; i++)
+    {
+        sprintf(buffer, "s%d", i);
+        intern(buffer);
+    }
+    testassert(intern_count() == count + 99999, "intern count failed");
+    testassert(intern("s0") == first, "interned string moved");
+    testpass();
+}
+
+void test_init()
+{
+    testreg(intern);
+    testreg(many);
+}
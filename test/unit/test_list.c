@@ -17,7 +17,24 @@ testdef(list)
     testpass();
 }
 
+testdef(vector)
+{
+    vector *v = new_vector();
+    testassert(v->len == 0, "new vector is not empty");
+    int *objs = newvalarr(int, 1000);
+    for (int i = 0; i < 1000; i++)
+    {
+        objs[i] = i;
+        vector_push(v, &objs[i]);
+    }
+    testassert(v->len == 1000 && v->capacity >= 1000, "vector len failed");
+    for (int i = 0; i < 1000; i++)
+        testassert(*(int *)v->data[i] == i, "vector order failed");
+    testpass();
+}
+
 void test_init()
 {
     testreg(list);
+    testreg(vector);
 }
@@ -23,8 +23,42 @@ testdef(arr)
     testpass();
 }
 
+testdef(arena)
+{
+    arena_phase last = arena_enter(ARENA_IR);
+    testassert(last == ARENA_NONE, "default arena is not none");
+    int *i = new (int);
+    testassert(*i == 0, "arena object is not zeroed");
+    testassert(instanceof(int, i), "instanceof failed");
+    int **arr = newarr(int, 100000);
+    testassert(instancearrof(int, arr), "instancearrof failed");
+    testassert(arr[99999] == NULL, "arena array is not zeroed");
+    for (int k = 0; k < 10000; k++)
+    {
+        int *j = new (int);
+        testassert(((size_t)j & 7) == 0, "arena object is not aligned");
+        *j = k;
+    }
+    delete (i);
+    testassert(arena_size(ARENA_IR) >= sizeof(int *) * 100000, "arena size is wrong");
+    arena_enter(last);
+    arena_release(ARENA_IR);
+    testassert(arena_size(ARENA_IR) == 0, "arena is not released");
+    testpass();
+}
+
+testdef(typeid)
+{
+    int a = typeidobj("int"), b = typeidobj("double");
+    testassert(a != 0 && b != 0 && a != b, "typeidobj failed");
+    testassert(typeidobj("int") == a, "typeidobj is not stable");
+    testpass();
+}
+
 void test_init()
 {
     testreg(object);
     testreg(arr);
+    testreg(arena);
+    testreg(typeid);
 }
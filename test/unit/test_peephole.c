@@ -0,0 +1,105 @@
+#include "unittest.h"
+#include "peephole.h"
+#include "intern.h"
+
+static mips_list *code = NULL;
+
+static mips_instr *emit(mips_op op, int rd, int rs, int rt, int imm)
+{
+    mips_instr *in = mips_push(code, op);
+    in->rd = rd;
+    in->rs = rs;
+    in->rt = rt;
+    in->imm = imm;
+    return in;
+}
+
+static void emit_label(mips_op op, const char *name)
+{
+    emit(op, 0, 0, 0, 0)->label = intern(name);
+}
+
+static int live()
+{
+    int count = 0;
+    for (int i = 0; i < code->len; i++)
+    {
+        if (!code->data[i].dead)
+            count++;
+    }
+    return count;
+}
+
+testdef(moves)
+{
+    code = new_mips_list();
+    emit(MI_Move, 8, 8, 0, 0);
+    emit(MI_Sw, 0, 30, 9, 12);
+    emit(MI_Lw, 0, 30, 9, 12);
+    emit(MI_Sw, 0, 30, 9, 16);
+    emit(MI_Comment, 0, 0, 0, 0)->text = "between";
+    emit(MI_Lw, 0, 30, 10, 16);
+    peephole_run(code);
+    testassert(code->data[0].dead, "self move kept");
+    testassert(!code->data[1].dead && code->data[2].dead, "load after store kept");
+    mips_instr *in = &code->data[5];
+    testassert(in->op == MI_Move && in->rd == 10 && in->rs == 9, "load into another register failed");
+    testassert(peephole_removed[PH_StoreLoad] == 1, "move counted as removed");
+    testpass();
+}
+
+testdef(stack)
+{
+    code = new_mips_list();
+    emit(MI_Addi, 29, 29, 0, -4);
+    emit(MI_Sw, 0, 29, 8, 0);
+    emit(MI_Lw, 0, 29, 9, 0);
+    emit(MI_Addi, 29, 29, 0, 4);
+    emit(MI_Addi, 29, 29, 0, -8);
+    emit(MI_Addi, 29, 29, 0, 8);
+    peephole_run(code);
+    testassert(live() == 1, "live count failed: %d", live());
+    testassert(code->data[2].op == MI_Move, "pop into another register failed");
+    testpass();
+}
+
+testdef(addi)
+{
+    code = new_mips_list();
+    emit(MI_Addi, 8, 8, 0, 20000);
+    emit(MI_Addi, 8, 8, 0, 20000);
+    emit(MI_Addi, 9, 9, 0, 3);
+    emit(MI_Addi, 9, 9, 0, -1);
+    peephole_run(code);
+    testassert(!code->data[0].dead && !code->data[1].dead && code->data[0].imm == 20000, "merged past the immediate");
+    testassert(code->data[2].imm == 2 && code->data[3].dead, "addi merge failed");
+    testassert(peephole_removed[PH_AddiMerge] > 0, "removed counts failed");
+    testpass();
+}
+
+// bgtz $t0, l1; j l2; l1: ...; j l3; li ...; l3:
+testdef(jumps)
+{
+    code = new_mips_list();
+    emit(MI_Bgtz, 0, 8, 0, 0)->label = intern("l1");
+    emit_label(MI_J, "l2");
+    emit_label(MI_Label, "l1");
+    emit(MI_Li, 8, 0, 0, 1);
+    emit_label(MI_J, "l3");
+    emit(MI_Li, 8, 0, 0, 2);
+    emit_label(MI_Label, "l3");
+    peephole_run(code);
+    mips_instr *b = &code->data[0];
+    testassert(b->op == MI_Blez && b->label == intern("l2") && code->data[1].dead, "branch over jump failed");
+    testassert(code->data[4].dead && code->data[5].dead, "jump to next or unreachable kept");
+    testassert(peephole_removed[PH_BranchOverJump] > 0 && peephole_removed[PH_JumpNext] > 0, "removed counts failed");
+    testpass();
+}
+
+void test_init()
+{
+    testreg(moves);
+    testreg(stack);
+    testreg(addi);
+    testreg(jumps);
+}
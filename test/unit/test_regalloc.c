@@ -0,0 +1,150 @@
+#include "unittest.h"
+#include "regalloc.h"
+#include "irfixture.h"
+
+static void emit_func(const char *name)
+{
+    emit(IR_Func)->label = label(name);
+}
+
+static void emit_const(irvar *left, int value)
+{
+    ircode *code = emit(IR_Assign);
+    code->assign.left = op_var(left);
+    code->assign.right = op_const(value);
+}
+
+static void emit_add(irvar *target, irvar *op1, irvar *op2)
+{
+    ircode *code = emit(IR_Add);
+    code->bop.target = op_var(target);
+    code->bop.op1 = op_var(op1);
+    code->bop.op2 = op_var(op2);
+}
+
+static void emit_call(irvar *ret, const char *func)
+{
+    ircode *code = emit(IR_Call);
+    code->call.ret = op_var(ret);
+    code->call.func = label(func);
+}
+
+static void emit_return(irvar *var)
+{
+    emit(IR_Return)->ret = op_var(var);
+}
+
+static const int caller_saved[] = {8, 9};
+static const int callee_saved[] = {16};
+
+static regalloc *run(int func)
+{
+    ast *t = tree();
+    cfg *g = cfg_build(t);
+    regalloc *r = regalloc_new(t, caller_saved, 2, callee_saved, 1);
+    for (int i = 0; i <= func; i++)
+        regalloc_func(r, g->funcs[i], 8);
+    return r;
+}
+
+// FUNCTION main
+// a := #1
+// b := #2
+// c := a + b
+// d := c + a
+// RETURN d
+testdef(intervals)
+{
+    begin();
+    irvar *a = var(), *b = var(), *c = var(), *d = var();
+    emit_func("main");
+    emit_const(a, 1);
+    emit_const(b, 2);
+    emit_add(c, a, b);
+    emit_add(d, c, a);
+    emit_return(d);
+    regalloc *r = run(0);
+    int *reg = r->reg_of;
+    testassert(r->spill_count == 0, "spilled without pressure");
+    testassert(reg[a->id] >= 0 && reg[b->id] >= 0 && reg[c->id] >= 0 && reg[d->id] >= 0, "var left in memory");
+    testassert(reg[a->id] != reg[b->id] && reg[a->id] != reg[c->id], "live vars share a register");
+    testassert(reg[b->id] == reg[c->id], "dead var does not hand its register on");
+    testpass();
+}
+
+// FUNCTION main
+// a := #1 ... d := #4
+// x := a + b
+// y := c + d
+// z := x + y
+// RETURN z
+testdef(spill)
+{
+    begin();
+    irvar *a = var(), *b = var(), *c = var(), *d = var();
+    irvar *x = var(), *y = var(), *z = var();
+    emit_func("main");
+    emit_const(a, 1);
+    emit_const(b, 2);
+    emit_const(c, 3);
+    emit_const(d, 4);
+    emit_add(x, a, b);
+    emit_add(y, c, d);
+    emit_add(z, x, y);
+    emit_return(z);
+    regalloc *r = run(0);
+    int *reg = r->reg_of;
+    testassert(r->spill_count == 1, "spill count failed: %d", r->spill_count);
+    testassert(reg[d->id] < 0 && reg[c->id] >= 0, "the interval ending last is not spilled");
+    testassert(reg[z->id] >= 0, "var after pressure left in memory");
+    testassert(r->callee_count == 1 && r->slot_of[d->id] == 12 && r->frame_size == 16, "frame layout failed");
+    testpass();
+}
+
+// FUNCTION f
+// s := #1
+// RETURN s
+// FUNCTION main
+// s := #2
+// u := #3
+// v := CALL f
+// w := u + v
+// RETURN w
+// DEC x 16
+// RETURN x
+testdef(calls)
+{
+    begin();
+    irvar *s = var(), *u = var(), *v = var(), *w = var();
+    emit_func("f");
+    emit_const(s, 1);
+    emit_return(s);
+    emit_func("main");
+    emit_const(s, 2);
+    emit_const(u, 3);
+    emit_call(v, "f");
+    emit_add(w, u, v);
+    emit_return(w);
+    irvar *x = var();
+    ircode *dec = emit(IR_Dec);
+    dec->dec.op = op_var(x);
+    dec->dec.size = 16;
+    emit_return(x);
+    regalloc *r = run(1);
+    testassert(r->reg_of[s->id] >= 0, "var of both functions left in memory");
+    testassert(r->reg_of[u->id] == 16, "var crossing a call is not callee-saved");
+    testassert(r->callee_count == 1 && r->callee_regs[0] == 16, "callee-saved registers failed");
+    vector *saves = r->saves[6];
+    testassert(saves != NULL && saves->len == 0, "saves across call failed");
+    testassert(r->saves[5] == NULL, "saves on a code that is not a call");
+    testassert(r->callee_offset == 8 && r->save_offset == 12 && r->array_of[x->id] == 12, "frame layout failed");
+    testassert(r->frame_size == 28, "frame size failed: %d", r->frame_size);
+    testpass();
+}
+
+void test_init()
+{
+    testreg(intervals);
+    testreg(spill);
+    testreg(calls);
+}
@@ -1,6 +1,9 @@
+#include <stdio.h>
+#include <time.h>
 #include "unittest.h"
 #include "symbol.h"
 #include "type.h"
+#include "intern.h"
 
 testdef(table)
 {
@@ -18,7 +21,60 @@ testdef(table)
     testpass();
 }
 
+testdef(order)
+{
+    symbol_table *root = new_symbol_table(NULL);
+    char name[64];
+    for (int i = 0; i < 100; i++)
+    {
+        sprintf(name, "s%d", i);
+        st_add(root, new_symbol(name, i, new_type_unit(), SS_DEC));
+    }
+    testassert(st_len(root) == 100, "len failed");
+    symbol **arr = st_to_arr(root), **revarr = st_revto_arr(root);
+    for (int i = 0; i < 100; i++)
+    {
+        testassert(arr[i]->lineno == 99 - i, "to_arr order failed");
+        testassert(revarr[i]->lineno == i, "revto_arr order failed");
+    }
+    testpass();
+}
+
+testdef(bench)
+{
+    const int n = 100000;
+    symbol_table *globals = new_symbol_table(NULL);
+    symbol_table *locals = new_symbol_table(globals);
+    type *unit = new_type_unit();
+    char name[64];
+
+    clock_t start = clock();
+    for (int i = 0; i < n; i++)
+    {
+        sprintf(name, "g%d", i);
+        st_add(globals, new_symbol(name, i, unit, SS_DEC));
+        sprintf(name, "l%d", i);
+        st_add(locals, new_symbol(name, i, unit, SS_DEC));
+    }
+    for (int i = 0; i < n; i++)
+    {
+        sprintf(name, "g%d", i);
+        symbol *sym = st_find(locals, intern(name));
+        testassert(sym != NULL && sym->lineno == i, "find global failed");
+        sprintf(name, "l%d", i);
+        sym = st_find(locals, intern(name));
+        testassert(sym != NULL && sym->lineno == i, "find local failed");
+        testassert(st_findonly(globals, intern(name)) == NULL, "findonly failed");
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    Info("%d globals/locals added and found in %.3fs", n, seconds);
+    testassert(seconds < 5, "symbol table is too slow");
+    testpass();
+}
+
 void test_init()
 {
     testreg(table);
+    testreg(order);
+    testreg(bench);
 }
@@ -0,0 +1,107 @@
+#include "unittest.h"
+#include "symbol.h"
+#include "type.h"
+#include "object.h"
+#include "intern.h"
+
+static symbol **members(const char *a, type *ta, const char *b, type *tb)
+{
+    symbol **mems = newarr(symbol, 2);
+    mems[0] = new_symbol(a, 0, ta, SS_DEF);
+    mems[1] = new_symbol(b, 0, tb, SS_DEF);
+    return mems;
+}
+
+testdef(consing)
+{
+    type *i = new_type_meta(MT_INT);
+    type *f = new_type_meta(MT_FLOAT);
+    int lens1[] = {2, 3}, lens2[] = {2, 3}, lens3[] = {4, 3};
+    type *a1 = new_type_array(i, 2, lens1);
+    type *a2 = new_type_array(i, 2, lens2);
+    type *a3 = new_type_array(i, 2, lens3);
+    testassert(a1 == a2, "equal arrays are not shared");
+    testassert(a1 != a3, "arrays of different lens are shared");
+    testassert(type_array_descending(a1) == type_array_descending(a3), "descending arrays are not shared");
+
+    type *s1 = new_type_struct(2, members("x", i, "y", a1));
+    type *s2 = new_type_struct(2, members("x", i, "y", a2));
+    type *s3 = new_type_struct(2, members("p", i, "q", a1));
+    type *s4 = new_type_struct(2, members("x", i, "y", f));
+    testassert(s1 == s2, "equal structs are not shared");
+    testassert(s1 != s3, "structs of different member names are shared");
+    testassert(new_type_type(s1) == new_type_type(s2), "type of equal structs is not shared");
+    testassert(s1->hash == s3->hash, "hash depends on member names");
+    testassert(s1->hash != s4->hash, "hash ignores member types");
+    testpass();
+}
+
+testdef(eq)
+{
+    type *i = new_type_meta(MT_INT);
+    type *f = new_type_meta(MT_FLOAT);
+    int lens1[] = {2, 3}, lens3[] = {4, 3};
+    type *a1 = new_type_array(i, 2, lens1);
+    type *a3 = new_type_array(i, 2, lens3);
+    testassert(type_full_eq(a1, a3, false), "non-strict array eq failed");
+    testassert(!type_full_eq(a1, a3, true), "strict array eq failed");
+
+    type *s1 = new_type_struct(2, members("x", i, "y", a1));
+    type *s3 = new_type_struct(2, members("p", i, "q", a1));
+    type *s4 = new_type_struct(2, members("x", i, "y", f));
+    type *s5 = new_type_struct(2, members("x", i, "y", a3));
+    testassert(type_full_eq(s1, s3, false), "struct eq depends on names");
+    testassert(!type_full_eq(s1, s4, false), "struct eq failed");
+    testassert(!type_full_eq(s1, s5, false), "struct members are not strict");
+
+    type *w = new_type_struct(2, members("x", i, "y", new_type_any()));
+    testassert(w->wild, "wild flag failed");
+    testassert(type_full_eq(s1, w, false) && type_full_eq(s4, w, false), "wild struct eq failed");
+    testassert(type_full_eq(new_type_never(), s1, false), "never eq failed");
+    testpass();
+}
+
+testdef(layout)
+{
+    type *i = new_type_meta(MT_INT);
+    int lens[] = {2, 3};
+    type *a = new_type_array(i, 2, lens);
+    testassert(type_sizeof(a) == 24, "array size failed");
+    type *inner = new_type_struct(2, members("x", i, "y", a));
+    testassert(type_sizeof(inner) == 28, "struct size failed");
+    type *outer = new_type_struct(2, members("p", a, "q", inner));
+    testassert(type_sizeof(outer) == 52, "nested struct size failed");
+
+    int offset = -1;
+    symbol *q = type_member(outer, intern("q"), &offset);
+    testassert(q != NULL && q->tp == inner && offset == 24, "member offset failed");
+    symbol *y = type_member(q->tp, intern("y"), &offset);
+    testassert(y != NULL && y->tp == a && offset == 4, "nested member offset failed");
+    testassert(type_can_membername(outer, intern("x")) == NULL, "missing member found");
+    testpass();
+}
+
+// types made in an arena are forgotten with it
+testdef(release)
+{
+    arena_phase last = arena_enter(ARENA_SEMANTICS);
+    int lens[] = {2};
+    new_type_array(new_type_meta(MT_INT), 1, lens);
+    arena_enter(last);
+    arena_release(ARENA_SEMANTICS);
+    type_release();
+
+    type *i = new_type_meta(MT_INT);
+    testassert(i->cls == TC_META && i->metatype == MT_INT, "int after release failed");
+    type *a = new_type_array(i, 1, lens);
+    testassert(a == new_type_array(i, 1, lens) && a->base == i, "array after release failed");
+    testpass();
+}
+
+void test_init()
+{
+    testreg(consing);
+    testreg(eq);
+    testreg(layout);
+    testreg(release);
+}